@@ -48,6 +48,11 @@ static ALWAYS_INLINE void arch_dccivac(void* p, int n) {
         asm volatile("dc civac, %[x]" : : [x] "r"(p + n));
 }
 
+/* Data cache invalidate by virtual address to point of coherency, dirty data is lost. */
+static ALWAYS_INLINE void arch_dcivac(void* p) {
+    asm volatile("dc ivac, %[x]" : : [x] "r"(p));
+}
+
 // for `device_get/put_*`, there's no need to protect them with architectual
 // barriers, since they are intended to access device memory regions. These
 // regions are already marked as nGnRnE in `kernel_pt`.
@@ -13,7 +13,7 @@
 typedef struct buf {
     int flags;
     u32 blockno;
-    u8 data[BSIZE];  // 1B*512
+    u8 data[BSIZE] DMA_ALIGNED;  // 1B*512
 
     /*
      * Add other necessary elements. It depends on you.
@@ -21,6 +21,16 @@ typedef struct buf {
     /* TODO: Lab5 driver. */
     ListNode bnode;
     Semaphore bufsem;
+    // the request moves `count` sectors from `blockno` on at `addr`.
+    // `sdrw` points it to `data`, `sdrw_blocks` to a caller's buffer.
+    u8* addr;
+    u32 count;
+    // if set, called from the interrupt handler when the request completes,
+    // instead of posting `bufsem`. see `sd_submit`.
+    void (*done)(struct buf*);
+    void* arg;
+    // the next request merged into the same command by the driver.
+    struct buf* next;
 } buf;
 
 int bufqueue_push(Queue* q, buf* b);
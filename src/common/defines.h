@@ -50,6 +50,11 @@ typedef u64 usize;
 #define NO_IPA __attribute__((noipa))
 #define WARN_RESULT __attribute__ ((warn_unused_result))
 
+// the SD controller moves data behind the data cache, so a DMA buffer must
+// own every cache line it covers, see `sd_submit`.
+#define CACHE_LINE_SIZE 64
+#define DMA_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
 // NOTE: no_return will disable traps.
 // NO_RETURN NO_INLINE void no_return();
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <common/spinlock.h>
+
+// a sequence lock lets readers go without taking any lock. Writers are
+// serialized by `lock`, and keep `seq` odd while they modify the protected
+// data. A reader retries if `seq` was odd or has changed after its read, so
+// it should only copy the protected data, and never follow pointers in it.
+typedef struct {
+    SpinLock lock;
+    volatile u32 seq;
+} SeqLock;
+
+static INLINE void init_seqlock(SeqLock* lock) {
+    init_spinlock(&lock->lock);
+    lock->seq = 0;
+}
+
+// begin a read section and return the sequence number to check against.
+static INLINE u32 read_seqbegin(SeqLock* lock) {
+    u32 seq;
+    while ((seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE)) & 1) {}
+    return seq;
+}
+
+// return true if the read section begun with `seq` must be retried.
+static INLINE bool read_seqretry(SeqLock* lock, u32 seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static INLINE void write_seqlock(SeqLock* lock) {
+    _acquire_spinlock(&lock->lock);
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static INLINE void write_sequnlock(SeqLock* lock) {
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);
+    _release_spinlock(&lock->lock);
+}
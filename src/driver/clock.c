@@ -5,6 +5,7 @@
 
 #define CORE_CLOCK_CTRL(id) (LOCAL_BASE + 0x40 + 4 * (id))
 #define CORE_CLOCK_ENABLE   (1 << 1)
+#define CNTKCTL_EL0VCTEN    (1ll << 1)
 
 static struct {
     u64 one_ms;
@@ -15,6 +16,9 @@ void init_clock()
 {
     clock.one_ms = get_clock_frequency() / 1000;
 
+    // let user space read cntvct_el0 for timing.
+    asm volatile("msr cntkctl_el1, %[x]" ::[x] "r"(CNTKCTL_EL0VCTEN));
+
     // reserve one second for the first time.
     asm volatile("msr cntp_ctl_el0, %[x]" ::[x] "r"(1ll));
     reset_clock(1000);
@@ -27,6 +31,18 @@ u64 get_timestamp_ms()
     return get_timestamp() / clock.one_ms;
 }
 
+u64 get_timestamp_ns()
+{
+    u64 t = get_timestamp(), freq = get_clock_frequency();
+    return t / freq * 1000000000 + t % freq * 1000000000 / freq;
+}
+
+u64 ns_to_timestamp(u64 ns)
+{
+    u64 freq = get_clock_frequency();
+    return ns / 1000000000 * freq + ns % 1000000000 * freq / 1000000000;
+}
+
 void reset_clock(u64 countdown_ms)
 {
     u64 t = countdown_ms * clock.one_ms;
@@ -34,6 +50,13 @@ void reset_clock(u64 countdown_ms)
     asm volatile("msr cntp_tval_el0, %[x]" ::[x] "r"(t));
 }
 
+// unlike `reset_clock`, the deadline is in counter ticks and not limited
+// to 32 bits. a deadline in the past fires at once.
+void reset_clock_at(u64 timestamp)
+{
+    asm volatile("msr cntp_cval_el0, %[x]" ::[x] "r"(timestamp));
+}
+
 void set_clock_handler(ClockHandler handler)
 {
     clock.handler = handler;
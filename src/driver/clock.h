@@ -5,8 +5,11 @@
 typedef void (*ClockHandler)(void);
 
 WARN_RESULT u64 get_timestamp_ms();
+WARN_RESULT u64 get_timestamp_ns();
+WARN_RESULT u64 ns_to_timestamp(u64 ns);
 void init_clock();
 void reset_clock(u64 countdown_ms);
+void reset_clock_at(u64 timestamp);
 void set_clock_handler(ClockHandler handler);
 void invoke_clock_handler();
 
@@ -8,6 +8,7 @@
 #include <kernel/sched.h>
 
 static InterruptHandler int_handler[NUM_IRQ_TYPES];
+static InterruptHandler ipi_handler[NUM_IPI_TYPES];
 
 define_early_init(interrupt)
 {
@@ -15,6 +16,10 @@ define_early_init(interrupt)
     {
         int_handler[i] = NULL;
     }
+    for (usize i = 0; i < NUM_IPI_TYPES; i++)
+    {
+        ipi_handler[i] = NULL;
+    }
     // device_put_u32(ENABLE_IRQS_1, AUX_INT);
     // device_put_u32(ENABLE_IRQS_2, VC_ARASANSDIO_INT);
     device_put_u32(GPU_INT_ROUTE, GPU_IRQ2CORE(0));
@@ -26,6 +31,46 @@ void set_interrupt_handler(InterruptType type, InterruptHandler handler)
     int_handler[type] = handler;
 }
 
+// the secondary cores are woken up through the spin table (see `start.S`),
+// so the mailboxes are free for IPIs. every core enables its own.
+void init_ipi()
+{
+    device_put_u32(MBOX_CLR(cpuid(), 0), 0xffffffff);
+    device_put_u32(MBOX_INT_CTRL(cpuid()), 1 << 0);
+}
+
+void set_ipi_handler(IpiType type, InterruptHandler handler)
+{
+    ipi_handler[type] = handler;
+}
+
+// IPIs of the same type sent before the target handles them are merged.
+void send_ipi(int cpu, IpiType type)
+{
+    device_put_u32(MBOX_SET(cpu, 0), 1u << type);
+}
+
+static void handle_ipi()
+{
+    u32 map = device_get_u32(MBOX_CLR(cpuid(), 0));
+    device_put_u32(MBOX_CLR(cpuid(), 0), map);
+    for (usize i = 0; i < NUM_IPI_TYPES; i++)
+    {
+        if ((map >> i) & 1)
+        {
+            if (ipi_handler[i])
+            {
+                ipi_handler[i]();
+            }
+            else
+            {
+                printk("Unknown IPI type %lld", i);
+                PANIC();
+            }
+        }
+    }
+}
+
 void interrupt_global_handler()
 {
     u32 source = device_get_u32(IRQ_SRC_CORE(cpuid()));
@@ -36,6 +81,12 @@ void interrupt_global_handler()
         invoke_clock_handler();
     }
 
+    if (source & IRQ_SRC_MBOX(0))
+    {
+        source ^= IRQ_SRC_MBOX(0);
+        handle_ipi();
+    }
+
     if (source & IRQ_SRC_GPU)
     {
         source ^= IRQ_SRC_GPU;
@@ -14,3 +14,14 @@ typedef void (*InterruptHandler)();
 
 void interrupt_global_handler();
 void set_interrupt_handler(InterruptType type, InterruptHandler handler);
+
+/* Inter-Processor Interrupts, through mailbox 0 of every core */
+#define NUM_IPI_TYPES 32
+
+typedef enum {
+    IPI_RESCHED = 0,
+} IpiType;
+
+void init_ipi();
+void set_ipi_handler(IpiType type, InterruptHandler handler);
+void send_ipi(int cpu, IpiType type);
@@ -21,9 +21,15 @@
 #define IRQ_SRC_CORE(i) (LOCAL_BASE + 0x60 + 4 * (i))
 #define IRQ_SRC_TIMER       (1 << 11) /* Local Timer */
 #define IRQ_SRC_GPU         (1 << 8)
+#define IRQ_SRC_MBOX(j)     (1 << (4 + (j))) /* Core Mailbox j */
 #define IRQ_SRC_CNTPNSIRQ   (1 << 1) /* Core Timer */
 #define FIQ_SRC_CORE(i)   (LOCAL_BASE + 0x70 + 4 * (i))
 
+/* Core Mailboxes */
+#define MBOX_INT_CTRL(i)  (LOCAL_BASE + 0x50 + 4 * (i))
+#define MBOX_SET(i, j)    (LOCAL_BASE + 0x80 + 16 * (i) + 4 * (j)) /* write-set */
+#define MBOX_CLR(i, j)    (LOCAL_BASE + 0xC0 + 16 * (i) + 4 * (j)) /* read / write-clear */
+
 /* Local timer */
 #define TIMER_ROUTE       (LOCAL_BASE + 0x24)
 #define TIMER_IRQ2CORE(i) (i)
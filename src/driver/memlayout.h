@@ -2,6 +2,7 @@
 
 #define EXTMEM  0x80000    /* Start of extended memory */
 #define PHYSTOP 0x3f000000 /* Top physical memory */
+#define RAMDISK_BASE 0x30000000 /* Where a RAM disk image may be loaded */
 
 #define KSPACE_MASK 0xffff000000000000
 #define KERNLINK    (KSPACE_MASK + EXTMEM) /* Address where kernel is linked */
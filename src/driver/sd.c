@@ -1,8 +1,42 @@
 
+#include <aarch64/mmu.h>
 #include <driver/sddef.h>
-static Queue bufQueue;
 static SpinLock sdlock;
 static u32 LBA, Nsectors;
+
+// the elevator: requests wait in `pending`, sorted by sector, and are
+// served in C-LOOK order, sweeping up from `head_sector` and jumping back
+// to the lowest one at the end. one command runs at a time; it starts at
+// `active` and takes `active_count` sectors, with the requests that
+// continue it on the card merged into it through `buf.next`.
+#define SD_MAX_MERGE 64
+static ListNode pending;
+static u32 head_sector;
+static buf* active;
+static u32 active_count;
+static u32 depth;  // requests queued or running.
+static u32 max_depth;
+static u64 num_merged;
+
+// how data moves between the card and memory, see `sd_dma_probe`.
+#define SD_PIO 0
+#define SD_SDMA 1
+#define SD_ADMA2 2
+static int dma_mode;
+static u64 sdma_next;  // the next boundary the running SDMA transfer stops at.
+// the next sector the running PIO command moves: sector `pio_sector` of
+// `pio_buf`, or none left if `pio_buf` is NULL. see `sd_pio_intr`.
+static buf* pio_buf;
+static u32 pio_sector;
+
+// ADMA2 32-bit descriptor: one physically contiguous piece of the buffer.
+typedef struct {
+    u16 attr;
+    u16 len;  // 0 means ADMA2_MAX_LEN.
+    u32 addr;
+} AdmaDesc;
+static AdmaDesc adma_table[SD_MAX_BLOCKS * BSIZE / ADMA2_MAX_LEN + SD_MAX_MERGE] DMA_ALIGNED;
+static void sd_dma_probe(const u8* mbr);
 /*
  * Initialize SD card.
  * Returns zero if initialization was successful, non-zero otherwise.
@@ -60,7 +94,7 @@ void sd_init() {
      */
     sdInit();
     init_spinlock(&sdlock);
-    queue_init(&bufQueue);
+    init_list_node(&pending);
     set_interrupt_handler(IRQ_SDIO, sd_intr);
     set_interrupt_handler(IRQ_ARASANSDIO, sd_intr);
     buf b;
@@ -72,9 +106,147 @@ void sd_init() {
     Nsectors = p[3];
     printk("LBA:%d\n",LBA);
     printk("Nsectors:%d\n",Nsectors);
+    sd_dma_probe(b.data);
+}
+
+/*
+ * Write back and drop the data cache lines over [p, p + n) before a
+ * transfer, so that the controller reads what the CPU wrote, and no dirty
+ * line is evicted over what it writes.
+ */
+static void sd_dma_sync(void* p, usize n) {
+    for (u64 a = (u64)p & ~(u64)(CACHE_LINE_SIZE - 1); a < (u64)p + n; a += CACHE_LINE_SIZE)
+        arch_dccivac((void*)a, 1);
+    arch_dsb_sy();
+}
+
+/*
+ * Drop the lines over [p, p + n) after the controller wrote them, as the
+ * CPU may have fetched them again speculatively meanwhile. `sd_submit`
+ * makes sure the buffer owns whole lines, nothing else lives in them.
+ */
+static void sd_dma_invalidate(void* p, usize n) {
+    for (u64 a = (u64)p; a < (u64)p + n; a += CACHE_LINE_SIZE)
+        arch_dcivac((void*)a);
+    arch_dsb_sy();
+}
+
+/*
+ * Program the DMA engine for the running command and send it. Kernel memory
+ * is mapped linearly, so each buffer is physically contiguous: ADMA2 needs
+ * one descriptor per ADMA2_MAX_LEN bytes of each, SDMA only gets commands
+ * whose buffers follow each other in memory and just takes the start.
+ */
+static int sd_dma_start(int cmd, int bno) {
+    usize i = 0;
+    for (buf* b = active; b; b = b->next) {
+        usize len = b->count * BSIZE;
+        u64 pa = K2P(b->addr);
+        if (pa + len > 0x100000000ull) {
+            printk("* EMMC DMA only reaches the first 4GB.\n");
+            PANIC();
+        }
+        sd_dma_sync(b->addr, len);
+        for (usize off = 0; dma_mode == SD_ADMA2 && off < len;
+             off += ADMA2_MAX_LEN, i++) {
+            adma_table[i].addr = (u32)(pa + off);
+            adma_table[i].len = (u16)MIN(len - off, (usize)ADMA2_MAX_LEN);
+            adma_table[i].attr = ADMA2_VALID | ADMA2_TRAN;
+        }
+    }
+    *EMMC_CONTROL0 = (*EMMC_CONTROL0 & ~(u32)C0_HCTL_DMA_MASK) |
+                     (dma_mode == SD_ADMA2 ? C0_HCTL_ADMA2 : C0_HCTL_SDMA);
+    if (dma_mode == SD_ADMA2) {
+        adma_table[i - 1].attr |= ADMA2_END;
+        sd_dma_sync(adma_table, i * sizeof(AdmaDesc));
+        *EMMC_ADMA_ADDR = (u32)K2P(adma_table);
+    } else {
+        u64 pa = K2P(active->addr);
+        *EMMC_SDMA_ADDR = (u32)pa;
+        sdma_next = (pa & ~(u64)(SDMA_BOUNDARY_SIZE - 1)) + SDMA_BOUNDARY_SIZE;
+        *EMMC_BLKSIZECNT |= BLK_SDMA_BOUNDARY;
+    }
+    EMMCCommand c = sdCommandTable[cmd];
+    c.code |= TM_DMA_EN;
+    return sdSendCommandP(&c, bno);
+}
+
+/*
+ * Handle the interrupt of the running DMA command.
+ * Returns false if it only crossed an SDMA boundary and goes on.
+ */
+static bool sd_dma_intr() {
+    u32 ival = *EMMC_INTERRUPT;
+    if ((ival & INT_DMA) && !(ival & (INT_DATA_DONE | INT_ERROR_MASK))) {
+        *EMMC_INTERRUPT = INT_DMA;
+        *EMMC_SDMA_ADDR = (u32)sdma_next;
+        sdma_next += SDMA_BOUNDARY_SIZE;
+        return false;
+    }
+    if (sdWaitForInterrupt(INT_DATA_DONE))
+        PANIC();
+    *EMMC_INTERRUPT = INT_DMA;
+    // lines fetched speculatively during the transfer are stale.
+    for (buf* b = active; b; b = b->next) {
+        if (!(b->flags & B_DIRTY))
+            sd_dma_invalidate(b->addr, b->count * BSIZE);
+    }
+    return true;
+}
+
+/*
+ * Read sector 0 with `mode` and compare it with `expect`, read by PIO.
+ * The interrupt signal is off meanwhile, so `sd_intr` never sees it.
+ */
+static bool sd_dma_try(int mode, const u8* expect) {
+    static u32 probe[BSIZE / sizeof(u32)] DMA_ALIGNED;
+    buf b;
+    b.blockno = 0;
+    b.flags = 0;
+    b.addr = (u8*)probe;
+    b.count = 1;
+    b.next = NULL;
+    memset(probe, 0, sizeof(probe));
+    u32 en = *EMMC_IRPT_EN;
+    *EMMC_IRPT_EN = 0;
+    dma_mode = mode;
+    active = &b;
+    *EMMC_BLKSIZECNT = (1 << 16) | 512;
+    bool ok = !sd_dma_start(IX_READ_SINGLE, 0) &&
+              !sdWaitForInterrupt(INT_DATA_DONE);
+    active = NULL;
+    if (ok) {
+        sd_dma_invalidate(probe, sizeof(probe));
+        ok = memcmp(probe, expect, BSIZE) == 0;
+    }
+    if (!ok) {
+        *EMMC_CONTROL1 |= C1_SRST_DATA;
+        int count = 10000;
+        while ((*EMMC_CONTROL1 & C1_SRST_DATA) && count--)
+            sd_delayus(10);
+        *EMMC_CONTROL0 &= ~(u32)C0_HCTL_DMA_MASK;
+        dma_mode = SD_PIO;
+    }
+    get_and_clear_EMMC_INTERRUPT();
+    *EMMC_IRPT_EN = en;
+    return ok;
 }
 
-/* Start the request for b. Caller must hold sdlock. */
+/*
+ * Pick the DMA engine that really works, or stay with PIO. The capability
+ * register is not documented for the Pi (and QEMU's model does not report
+ * SDMA although it has it), so SDMA is always tried.
+ */
+static void sd_dma_probe(const u8* mbr) {
+    if ((*EMMC_HOST_CAPS & CAPS_ADMA2) && sd_dma_try(SD_ADMA2, mbr))
+        printk("- sd: ADMA2 transfers\n");
+    else if (sd_dma_try(SD_SDMA, mbr))
+        printk("- sd: SDMA transfers\n");
+    else
+        printk("- sd: PIO transfers\n");
+}
+
+/* Start the command for b, which is `active`. Caller must hold sdlock. */
 static void sd_start(struct buf* b) {
     // Address is different depending on the card type.
     // HC pass address as block #.
@@ -96,37 +268,110 @@ static void sd_start(struct buf* b) {
     arch_dsb_sy();
 
     // Work out the status, interrupt and command values for the transfer.
-    int cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
+    // More than one block is a single CMD18/CMD25 that the controller stops
+    // after `count` blocks; the card is told with CMD12 in `sd_intr`.
+    u32 count = active_count;
+    int cmd;
+    if (count > 1)
+        cmd = write ? IX_WRITE_MULTI : IX_READ_MULTI;
+    else
+        cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
 
     int resp;
-    *EMMC_BLKSIZECNT = 512;
+    *EMMC_BLKSIZECNT = (count << 16) | 512;
 
+    if (dma_mode != SD_PIO) {
+        // the controller moves the data, `sd_intr` runs when it is done.
+        if (sd_dma_start(cmd, bno)) {
+            printk("* EMMC send command error.\n");
+            PANIC();
+        }
+        return;
+    }
+
+    // the sectors go through the data port one interrupt at a time.
+    pio_buf = b;
+    pio_sector = 0;
     if ((resp = sdSendCommandA(cmd, bno))) {
         printk("* EMMC send command error.\n");
         PANIC();
     }
+}
 
-    int done = 0;
-    u32* intbuf = (u32*)b->data;
-    if (!(((i64)b->data) & 0x03) == 0) {
-        printk("Only support word-aligned buffers. \n");
+/*
+ * Handle the interrupt of the running PIO command. The controller raises
+ * READ_RDY or WRITE_RDY once per sector, so each interrupt copies one
+ * sector through the data port instead of spinning on the card for the
+ * whole command. Returns true once the command is done.
+ */
+static bool sd_pio_intr() {
+    if (!pio_buf) {
+        if (sdWaitForInterrupt(INT_DATA_DONE))
+            PANIC();
+        return true;
+    }
+    bool write = active->flags & B_DIRTY;
+    if (sdWaitForInterrupt(write ? INT_WRITE_RDY : INT_READ_RDY)) {
+        printk("* EMMC ERROR: Timeout waiting for ready to %s\n", write ? "write" : "read");
         PANIC();
     }
+    u32* intbuf = (u32*)(pio_buf->addr + pio_sector * BSIZE);
+    arch_dsb_sy();
+    for (int i = 0; i < 128; i++) {
+        if (write)
+            *EMMC_DATA = intbuf[i];
+        else
+            intbuf[i] = get_EMMC_DATA();
+    }
+    arch_dsb_sy();
+    if (++pio_sector == pio_buf->count) {
+        pio_buf = pio_buf->next;
+        pio_sector = 0;
+    }
+    // the last sector is followed by DATA_DONE.
+    return false;
+}
 
-    if (write) {
-        // Wait for ready interrupt for the next block.
-        if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
-            printk("* EMMC ERROR: Timeout waiting for ready to write\n");
-            PANIC();
-            // return sdDebugResponse(resp);
-        }
-        if (*EMMC_INTERRUPT) {
-            printk("%d\n", *EMMC_INTERRUPT);
-            PANIC();
-        }
-        while (done < 128)
-            *EMMC_DATA = intbuf[done++];
+/* can `b` be merged into the command that `last` ends, `count` sectors long? */
+static bool sd_can_merge(buf* last, buf* b, u32 count) {
+    return (b->flags & B_DIRTY) == (last->flags & B_DIRTY) &&
+           b->blockno == last->blockno + last->count &&
+           count + b->count <= SD_MAX_BLOCKS &&
+           (dma_mode != SD_SDMA || b->addr == last->addr + last->count * BSIZE);
+}
+
+/*
+ * Take the next command off `pending` in C-LOOK order, merge the requests
+ * that continue it, and start it. Caller must hold sdlock, with no command
+ * running.
+ */
+static void sd_dispatch() {
+    if (_empty_list(&pending))
+        return;
+    ListNode* p = pending.next;
+    while (p != &pending && container_of(p, buf, bnode)->blockno < head_sector)
+        p = p->next;
+    if (p == &pending)
+        p = pending.next;
+    active = container_of(p, buf, bnode);
+    active_count = active->count;
+    p = p->next;
+    _detach_from_list(&active->bnode);
+    buf* last = active;
+    for (int n = 1; p != &pending && n < SD_MAX_MERGE; n++) {
+        buf* b = container_of(p, buf, bnode);
+        if (!sd_can_merge(last, b, active_count))
+            break;
+        p = p->next;
+        _detach_from_list(&b->bnode);
+        last->next = b;
+        last = b;
+        active_count += b->count;
+        num_merged++;
     }
+    last->next = NULL;
+    head_sector = active->blockno + active_count;
+    sd_start(active);
 }
 
 /* The interrupt handler. Sync buf with disk.*/
@@ -152,40 +397,51 @@ void sd_intr() {
      *
      * TODO: Lab5 driver.
      */
-    buf* b = bufqueue_front(&bufQueue);
     arch_dsb_sy();
-    if(b->flags & B_DIRTY){
-        if(sdWaitForInterrupt(INT_DATA_DONE)){
-            PANIC();
-        }
-    }else{
-        if(sdWaitForInterrupt(INT_READ_RDY)){
-            PANIC();
-        }
-        int done = 0;
-        u32* intbuf = (u32*)b->data;
-        arch_dsb_sy();
-        while (done < 128)
-            intbuf[done++] = get_EMMC_DATA();
-        arch_dsb_sy();
-        if(sdWaitForInterrupt(INT_DATA_DONE)){
+    if(dma_mode != SD_PIO){
+        if(!sd_dma_intr())
+            return;
+    }else if(!sd_pio_intr()){
+        return;
+    }
+    if(active_count > 1){
+        // end the open-ended multiple block transfer.
+        if(sdSendCommand(IX_STOP_TRANS) || sdWaitForData()){
             PANIC();
         }
+        get_and_clear_EMMC_INTERRUPT();
     }
-    b->flags = B_VALID;
     arch_dsb_sy();
     _acquire_spinlock(&sdlock);
-    bufqueue_pop(&bufQueue);
-    post_sem(&b->bufsem);
-    arch_dsb_sy();
-    if(!bufqueue_empty(&bufQueue)){
-        sd_start(bufqueue_front(&bufQueue));
-    }
+    buf* finished = active;
+    for(buf* b = finished; b; b = b->next)
+        depth--;
+    active = NULL;
+    sd_dispatch();
     _release_spinlock(&sdlock);
+    // the requests are out of the driver's hands once they are told.
+    while(finished){
+        buf* b = finished;
+        finished = b->next;
+        b->flags = B_VALID;
+        arch_dsb_sy();
+        if(b->done)
+            b->done(b);
+        else
+            post_sem(&b->bufsem);
+    }
     arch_dsb_sy();
 }
 
 void sdrw(buf* b) {
+    sdrw_blocks(b, b->data, 1);
+}
+
+/*
+ * Move `count` sectors from `b->blockno` on between the card and `addr` with
+ * one command. `addr` must be DMA_ALIGNED; `b->data` is left untouched.
+ */
+void sdrw_blocks(buf* b, u8* addr, u32 count) {
     /*
      * 1.add buf to the queue
      * 2.if no buf in queue before,send request now
@@ -195,14 +451,10 @@ void sdrw(buf* b) {
      * sd_start(), wait_sem() to complete this function.
      *  TODO: Lab5 driver.
      */
-    arch_dsb_sy();
-    init_sem(&b->bufsem, 0);
-    _acquire_spinlock(&sdlock);
-    if(bufqueue_push(&bufQueue, b) == 1){
-        sd_start(b);
-    }
-    _release_spinlock(&sdlock);
-    arch_dsb_sy();
+    b->addr = addr;
+    b->count = count;
+    b->done = NULL;
+    sd_submit(b);
     while(1){
         if(!wait_sem(&b->bufsem)) break;
         if(b->flags == B_VALID) break;
@@ -210,6 +462,42 @@ void sdrw(buf* b) {
     arch_dsb_sy();
 }
 
+/*
+ * Queue b and return at once. `b->addr`, `b->count`, `b->blockno` and
+ * `b->flags` describe the transfer. When it completes, `b->flags` becomes
+ * B_VALID and `b->done(b)` is called from the interrupt handler, or
+ * `b->bufsem` is posted if `done` is NULL.
+ */
+void sd_submit(buf* b) {
+    ASSERT(b->count > 0 && b->count <= SD_MAX_BLOCKS);
+    if ((((i64)b->addr) & (CACHE_LINE_SIZE - 1)) != 0) {
+        printk("Only support cache line aligned buffers. \n");
+        PANIC();
+    }
+    init_sem(&b->bufsem, 0);
+    arch_dsb_sy();
+    _acquire_spinlock(&sdlock);
+    ListNode* p = pending.next;
+    while (p != &pending && container_of(p, buf, bnode)->blockno <= b->blockno)
+        p = p->next;
+    _insert_into_list(p->prev, &b->bnode);
+    depth++;
+    max_depth = MAX(max_depth, depth);
+    if (active == NULL)
+        sd_dispatch();
+    _release_spinlock(&sdlock);
+    arch_dsb_sy();
+}
+
+/* Number of requests queued or running. */
+u32 sd_queue_depth() {
+    return __atomic_load_n(&depth, __ATOMIC_RELAXED);
+}
+
+static void sd_test_done(buf* b) {
+    post_sem((Semaphore*)b->arg);
+}
+
 /* SD card test and benchmark. */
 void sd_test() {
     static struct buf b[1 << 11];
@@ -262,8 +550,8 @@ void sd_test() {
     arch_dsb_sy();
     t = (i64)get_timestamp() - t;
     arch_dsb_sy();
-    printk("- read %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s\n",
-           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10);
+    printk("- read %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s, %lld sectors/s\n",
+           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10, n * f / t);
 
     // Write benchmark
     arch_dsb_sy();
@@ -278,6 +566,75 @@ void sd_test() {
     t = (i64)get_timestamp() - t;
     arch_dsb_sy();
 
-    printk("- write %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s\n",
-           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10);
+    printk("- write %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s, %lld sectors/s\n",
+           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10, n * f / t);
+
+    // Multiple block benchmarks, `chunk` sectors per command. The blocks
+    // still hold the content of b[], which the reads are checked against.
+    static u32 data[(1 << 11) * BSIZE / sizeof(u32)] DMA_ALIGNED;
+    u8* p = (u8*)data;
+    const int chunk = 64;
+    arch_dsb_sy();
+    t = (i64)get_timestamp();
+    arch_dsb_sy();
+    for (int i = 0; i < n; i += chunk) {
+        b[0].flags = 0;
+        b[0].blockno = (u32)i;
+        sdrw_blocks(&b[0], p + i * BSIZE, (u32)MIN(chunk, n - i));
+    }
+    arch_dsb_sy();
+    t = (i64)get_timestamp() - t;
+    arch_dsb_sy();
+    for (int i = 0; i < n; i++) {
+        if (memcmp(p + i * BSIZE, b[i].data, BSIZE))
+            PANIC();
+    }
+    printk("- multi read %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s, %lld sectors/s\n",
+           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10, n * f / t);
+
+    arch_dsb_sy();
+    t = (i64)get_timestamp();
+    arch_dsb_sy();
+    for (int i = 0; i < n; i += chunk) {
+        b[0].flags = B_DIRTY;
+        b[0].blockno = (u32)i;
+        sdrw_blocks(&b[0], p + i * BSIZE, (u32)MIN(chunk, n - i));
+    }
+    arch_dsb_sy();
+    t = (i64)get_timestamp() - t;
+    arch_dsb_sy();
+    printk("- multi write %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s, %lld sectors/s\n",
+           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10, n * f / t);
+
+    // Queued benchmark: every sector is submitted at once in scrambled
+    // order, for the elevator to sort and merge.
+    static Semaphore all;
+    init_sem(&all, 0);
+    u64 merged = num_merged;
+    max_depth = 0;
+    arch_dsb_sy();
+    t = (i64)get_timestamp();
+    arch_dsb_sy();
+    for (int i = 0; i < n; i++) {
+        b[i].flags = 0;
+        b[i].blockno = (u32)((i * 1021) % n);
+        b[i].addr = b[i].data;
+        b[i].count = 1;
+        b[i].done = sd_test_done;
+        b[i].arg = &all;
+        sd_submit(&b[i]);
+    }
+    for (int i = 0; i < n; i++)
+        unalertable_wait_sem(&all);
+    arch_dsb_sy();
+    t = (i64)get_timestamp() - t;
+    arch_dsb_sy();
+    for (int i = 0; i < n; i++) {
+        if (memcmp(b[i].data, p + b[i].blockno * BSIZE, BSIZE))
+            PANIC();
+    }
+    printk("- queued read %dB (%dMB), t: %lld cycles, speed: %lld.%lld MB/s, %lld sectors/s, "
+           "max depth %d, %lld merged\n",
+           n * BSIZE, mb, t, mb * f / t, (mb * f * 10 / t) % 10, n * f / t,
+           max_depth, num_merged - merged);
 }
\ No newline at end of file
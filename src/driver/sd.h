@@ -18,7 +18,13 @@
 #define SD_READ_BLOCKS 0
 #define SD_WRITE_BLOCKS 1
 
+// the block count field of EMMC_BLKSIZECNT is 16 bits wide.
+#define SD_MAX_BLOCKS 0xffff
+
 void sd_init();
 void sd_intr();
 void sd_test();
 void sdrw(buf*);
+void sdrw_blocks(buf*, u8* addr, u32 count);
+void sd_submit(buf*);
+u32 sd_queue_depth();
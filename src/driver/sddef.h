@@ -65,8 +65,13 @@ int fls_long(unsigned long x);
 // #define EMMC_SPI_INT_SPT    ((volatile unsigned int*)(MMIO_BASE+0x003000f0))
 #define EMMC_SLOTISR_VER ((volatile unsigned int*)(MMIO_BASE + 0x003000fc))
 
-// This register is not available on the Pi.
-// #define EMMC_HOST_CAPS      ((volatile unsigned int*)(MMIO_BASE+0x00300040))
+// This register is not documented for the Pi, so what it reports is only
+// a hint: DMA is checked with a real transfer before it is used.
+#define EMMC_HOST_CAPS ((volatile unsigned int*)(MMIO_BASE + 0x00300040))
+#define EMMC_ADMA_ADDR ((volatile unsigned int*)(MMIO_BASE + 0x00300058))
+
+// SDMA uses ARG2 as its system address register.
+#define EMMC_SDMA_ADDR EMMC_ARG2
 
 // EMMC command flags
 #define CMD_TYPE_NORMAL 0x00000000
@@ -86,9 +91,11 @@ int fls_long(unsigned long x);
 #define TM_AUTO_CMD23 0x00000008
 #define TM_AUTO_CMD12 0x00000004
 #define TM_BLKCNT_EN 0x00000002
+#define TM_DMA_EN 0x00000001
 #define TM_MULTI_DATA (CMD_IS_DATA | TM_MULTI_BLOCK | TM_BLKCNT_EN)
 
 // INTERRUPT register settings
+#define INT_ADMA_ERROR 0x02000000
 #define INT_AUTO_ERROR 0x01000000
 #define INT_DATA_END_ERR 0x00400000
 #define INT_DATA_CRC_ERR 0x00200000
@@ -104,12 +111,14 @@ int fls_long(unsigned long x);
 #define INT_CARD 0x00000100
 #define INT_READ_RDY 0x00000020
 #define INT_WRITE_RDY 0x00000010
+#define INT_DMA 0x00000008
 #define INT_BLOCK_GAP 0x00000004
 #define INT_DATA_DONE 0x00000002
 #define INT_CMD_DONE 0x00000001
 #define INT_ERROR_MASK                                                    \
     (INT_CRC_ERROR | INT_END_ERROR | INT_INDEX_ERROR | INT_DATA_TIMEOUT | \
-     INT_DATA_CRC_ERR | INT_DATA_END_ERR | INT_ERR | INT_AUTO_ERROR)
+     INT_DATA_CRC_ERR | INT_DATA_END_ERR | INT_ERR | INT_AUTO_ERROR | \
+     INT_ADMA_ERROR)
 #define INT_ALL_MASK                                               \
     (INT_CMD_DONE | INT_DATA_DONE | INT_READ_RDY | INT_WRITE_RDY | \
      INT_ERROR_MASK)
@@ -118,6 +127,24 @@ int fls_long(unsigned long x);
 #define C0_SPI_MODE_EN 0x00100000
 #define C0_HCTL_HS_EN 0x00000004
 #define C0_HCTL_DWITDH 0x00000002
+#define C0_HCTL_DMA_MASK 0x00000018
+#define C0_HCTL_SDMA 0x00000000
+#define C0_HCTL_ADMA2 0x00000010
+
+// HOST_CAPS register settings
+#define CAPS_SDMA 0x00400000
+#define CAPS_ADMA2 0x00080000
+
+// BLKSIZECNT: SDMA stops at every 512KB boundary of the system address.
+#define BLK_SDMA_BOUNDARY 0x00007000
+#define SDMA_BOUNDARY_SIZE 0x80000
+
+// ADMA2 descriptor attributes
+#define ADMA2_VALID 0x0001
+#define ADMA2_END 0x0002
+#define ADMA2_INT 0x0004
+#define ADMA2_TRAN 0x0020
+#define ADMA2_MAX_LEN 0x10000
 
 #define C1_SRST_DATA 0x04000000
 #define C1_SRST_CMD 0x02000000
@@ -974,8 +1001,9 @@ static int sdResetCard(int resetType) {
     // Enable interrupts for command completion values.
     // *EMMC_IRPT_EN   = INT_ALL_MASK;
     // *EMMC_IRPT_MASK = INT_ALL_MASK;
-    // Ignore INT_CMD_DONE and INT_WRITE_RDY.
-    *EMMC_IRPT_EN = 0xffffffff & (u32)(~INT_CMD_DONE) & (~(u32)INT_WRITE_RDY);
+    // Ignore INT_CMD_DONE. INT_READ_RDY and INT_WRITE_RDY pace PIO
+    // transfers, see `sd_pio_intr`.
+    *EMMC_IRPT_EN = 0xffffffff & (u32)(~INT_CMD_DONE);
     *EMMC_IRPT_MASK = 0xffffffff;
     // printk("EMMC: Interrupt enable/mask registers: %08x
     // %08x\n",*EMMC_IRPT_EN,*EMMC_IRPT_MASK); printk("EMMC: Status: %08x,
@@ -1,35 +1,390 @@
+#include <aarch64/mmu.h>
+#include <common/spinlock.h>
+#include <driver/clock.h>
+#include <driver/memlayout.h>
 #include <driver/sd.h>
 #include <fs/block_device.h>
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
 #include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
 
 #define BLOCKNO_OFFSET 0x20800
 
+// whole blocks that fit in one multiple block command.
+#define MAX_SECTORS_PER_CMD (SD_MAX_BLOCKS / SECTORS_PER_BLOCK * SECTORS_PER_BLOCK)
+
+// a block is `SECTORS_PER_BLOCK` consecutive sectors starting from
+// `BLOCKNO_OFFSET + block_no * SECTORS_PER_BLOCK`.
+static INLINE u32 to_sector_no(usize block_no, usize i) {
+    return (u32)(BLOCKNO_OFFSET + block_no * SECTORS_PER_BLOCK + i);
+}
+
+// the commands of requests come out of `free_bufs`, carved from whole
+// pages so that each is DMA_ALIGNED as its type says, which `kalloc` does
+// not promise. pages may run out while the kernel writes pages out to swap
+// to free some, so `reserve` is kept for then, one command at a time.
+static QueueNode* free_bufs;
+static struct buf reserve;
+static Semaphore reserve_idle;
+
+static struct buf* alloc_buf() {
+    struct buf* b = (struct buf*)fetch_from_queue(&free_bufs);
+    if (b != NULL)
+        return b;
+    u8* page = kalloc_page();
+    if (page == NULL) {
+        unalertable_wait_sem(&reserve_idle);
+        return &reserve;
+    }
+    for (usize i = 1; i < PAGE_SIZE / sizeof(struct buf); i++)
+        add_to_queue(&free_bufs, (QueueNode*)(page + i * sizeof(struct buf)));
+    return (struct buf*)page;
+}
+
+// called from interrupt context.
+static void free_buf(struct buf* b) {
+    if (b == &reserve)
+        post_sem(&reserve_idle);
+    else
+        add_to_queue(&free_bufs, (QueueNode*)b);
+}
+
+static void sd_request_done(struct buf* b) {
+    BlockRequest* req = b->arg;
+    free_buf(b);
+    if (__atomic_sub_fetch(&req->num_pending, 1, __ATOMIC_ACQ_REL) == 0)
+        req->done(req);
+}
+
+// split `req` into as few multiple block commands as the driver takes, and
+// queue them all.
+static void sd_submit_request(BlockRequest* req) {
+    usize num_sectors = req->count * SECTORS_PER_BLOCK;
+    req->num_pending = (num_sectors + MAX_SECTORS_PER_CMD - 1) / MAX_SECTORS_PER_CMD;
+    for (usize i = 0; i < num_sectors;) {
+        usize n = MIN(num_sectors - i, (usize)MAX_SECTORS_PER_CMD);
+        struct buf* b = alloc_buf();
+        b->blockno = to_sector_no(req->block_no, i);
+        b->flags = req->write ? B_DIRTY | B_VALID : 0;
+        b->addr = req->buffer + i * SECTOR_SIZE;
+        b->count = (u32)n;
+        b->done = sd_request_done;
+        b->arg = req;
+        sd_submit(b);
+        i += n;
+    }
+}
+
+static void sync_done(BlockRequest* req) {
+    post_sem((Semaphore*)req->arg);
+}
+
+// the synchronous transfers are a request and a wait.
+static void sd_rw_blocks(usize block_no, usize count, u8* buffer, bool write) {
+    Semaphore sem;
+    init_sem(&sem, 0);
+    BlockRequest req = {
+        .block_no = block_no,
+        .count = count,
+        .buffer = buffer,
+        .write = write,
+        .done = sync_done,
+        .arg = &sem,
+    };
+    sd_submit_request(&req);
+    unalertable_wait_sem(&sem);
+}
+
+static void sd_read_blocks(usize block_no, usize count, u8* buffer) {
+    sd_rw_blocks(block_no, count, buffer, false);
+}
+
+static void sd_write_blocks(usize block_no, usize count, u8* buffer) {
+    sd_rw_blocks(block_no, count, buffer, true);
+}
+
 static void sd_read(usize block_no, u8* buffer) {
-    struct buf b;
-    b.blockno = (u32)block_no+BLOCKNO_OFFSET;
-    b.flags = 0;
-    sdrw(&b);
-    memcpy(buffer, b.data, BLOCK_SIZE);
+    sd_rw_blocks(block_no, 1, buffer, false);
 }
 
 static void sd_write(usize block_no, u8* buffer) {
-    struct buf b;
-    b.blockno = (u32)block_no+BLOCKNO_OFFSET;
-    b.flags = B_DIRTY | B_VALID;
-    memcpy(b.data, buffer, BLOCK_SIZE);
-    sdrw(&b);
+    sd_rw_blocks(block_no, 1, buffer, true);
+}
+
+// with the RAMDISK build option, a filesystem image loaded at RAMDISK_BASE,
+// by QEMU's loader device or the firmware, is used in place of the SD card.
+// it is not saved anywhere: it is meant for benchmarks that should not pay
+// for the SD controller.
+#ifdef RAMDISK
+#define USE_RAMDISK true
+#else
+#define USE_RAMDISK false
+#endif
+
+static u8* ramdisk;
+static usize ramdisk_blocks;
+
+usize ramdisk_size() {
+    if (!USE_RAMDISK)
+        return 0;
+    const SuperBlock* sb = (const SuperBlock*)(P2K(RAMDISK_BASE) + BLOCK_SIZE);
+    if (sb->magic != FS_MAGIC || sb->version != FS_VERSION || sb->block_size != BLOCK_SIZE)
+        return 0;
+    // the image must end below PHYSTOP, whatever its super block says.
+    if (sb->num_blocks > (PHYSTOP - RAMDISK_BASE) / BLOCK_SIZE)
+        return 0;
+    return (usize)sb->num_blocks * BLOCK_SIZE;
 }
 
-static u8 sblock_data[BLOCK_SIZE];
+static INLINE u8* ramdisk_at(usize block_no, usize count) {
+    if (block_no + count > ramdisk_blocks) {
+        printk("ramdisk: block %llu out of range\n", block_no + count - 1);
+        PANIC();
+    }
+    return ramdisk + block_no * BLOCK_SIZE;
+}
+
+static void ram_read_blocks(usize block_no, usize count, u8* buffer) {
+    memcpy(buffer, ramdisk_at(block_no, count), count * BLOCK_SIZE);
+}
+
+static void ram_write_blocks(usize block_no, usize count, u8* buffer) {
+    memcpy(ramdisk_at(block_no, count), buffer, count * BLOCK_SIZE);
+}
+
+static void ram_read(usize block_no, u8* buffer) {
+    ram_read_blocks(block_no, 1, buffer);
+}
+
+static void ram_write(usize block_no, u8* buffer) {
+    ram_write_blocks(block_no, 1, buffer);
+}
+
+// requests complete before `submit` returns.
+static void ram_submit(BlockRequest* req) {
+    if (req->write)
+        ram_write_blocks(req->block_no, req->count, req->buffer);
+    else
+        ram_read_blocks(req->block_no, req->count, req->buffer);
+    req->done(req);
+}
+
+// read by DMA, see `sd_submit`.
+static u8 sblock_data[BLOCK_SIZE] DMA_ALIGNED;
 BlockDevice block_device;
 
+// the RAM disk or the SD card. with the BLOCK_TRACE build option,
+// `block_device` records every transfer in `trace` and passes it on to
+// `device`; without it, `block_device` is `device`.
+#ifdef BLOCK_TRACE
+#define USE_BLOCK_TRACE true
+#else
+#define USE_BLOCK_TRACE false
+#endif
+
+static BlockDevice device;
+
+static struct {
+    SpinLock lock;
+    usize head, tail;  // records in [tail, head) are not dumped yet.
+    u64 num_dropped;
+    BlockTraceRecord records[BLOCK_TRACE_SIZE];
+} trace;
+
+static void trace_record(usize block_no, usize count, u16 op) {
+    struct proc* p = thisproc();
+    BlockTraceRecord r = {
+        .timestamp = get_timestamp_ns(),
+        .block_no = (u32)block_no,
+        .count = (u32)count,
+        .op = op,
+        .cpu = (u16)get_cpu_id(),
+        .pid = p ? p->pid : 0,
+    };
+    _acquire_spinlock(&trace.lock);
+    if (trace.head - trace.tail == BLOCK_TRACE_SIZE) {
+        trace.tail++;
+        trace.num_dropped++;
+    }
+    trace.records[trace.head++ % BLOCK_TRACE_SIZE] = r;
+    _release_spinlock(&trace.lock);
+}
+
+isize block_trace_dump(u8* buf, usize size) {
+    if (!USE_BLOCK_TRACE)
+        return -1;
+    if (size < sizeof(BlockTraceHeader) + sizeof(BlockTraceRecord))
+        return 0;
+    BlockTraceHeader* header = (BlockTraceHeader*)buf;
+    BlockTraceRecord* records = (BlockTraceRecord*)(header + 1);
+    usize n = (size - sizeof(BlockTraceHeader)) / sizeof(BlockTraceRecord);
+    _acquire_spinlock(&trace.lock);
+    n = MIN(n, trace.head - trace.tail);
+    for (usize i = 0; i < n; i++)
+        records[i] = trace.records[trace.tail++ % BLOCK_TRACE_SIZE];
+    header->num_dropped = trace.num_dropped;
+    trace.num_dropped = 0;
+    _release_spinlock(&trace.lock);
+    if (n == 0)
+        return 0;
+    header->magic = BLOCK_TRACE_MAGIC;
+    header->num_records = (u32)n;
+    header->sblock = *get_super_block();
+    return (isize)(sizeof(BlockTraceHeader) + n * sizeof(BlockTraceRecord));
+}
+
+// a replay keeps at most REPLAY_DEPTH requests outstanding, of at most
+// REPLAY_MAX_BLOCKS blocks each. longer records are split, and the
+// elevator merges the pieces again.
+#define REPLAY_DEPTH      32
+#define REPLAY_MAX_BLOCKS 16
+
+typedef struct {
+    BlockRequest req;
+    Semaphore idle;  // posted when `req` is not outstanding.
+} ReplaySlot;
+
+// the reads of every replay land here, nobody looks at them.
+static u8 replay_data[REPLAY_MAX_BLOCKS * BLOCK_SIZE] DMA_ALIGNED;
+
+static void replay_done(BlockRequest* req) {
+    post_sem(&((ReplaySlot*)req->arg)->idle);
+}
+
+i64 block_trace_replay(const u8* dump, usize size, bool timed) {
+    ReplaySlot* slots = kalloc_page();
+    if (slots == NULL)
+        return -1;
+    for (int i = 0; i < REPLAY_DEPTH; i++)
+        init_sem(&slots[i].idle, 1);
+
+    usize num_blocks = get_super_block()->num_blocks;
+    bool ok = true, started = false;
+    u64 first = 0, begin = get_timestamp_ns();
+    usize next = 0;
+    for (usize i = 0; ok && i < size;) {
+        BlockTraceHeader header;
+        if (size - i < sizeof(header)) {
+            ok = false;
+            break;
+        }
+        memcpy(&header, dump + i, sizeof(header));
+        i += sizeof(header);
+        if (header.magic != BLOCK_TRACE_MAGIC ||
+            (size - i) / sizeof(BlockTraceRecord) < header.num_records) {
+            ok = false;
+            break;
+        }
+        for (usize j = 0; j < header.num_records; j++) {
+            BlockTraceRecord r;
+            memcpy(&r, dump + i, sizeof(r));
+            i += sizeof(r);
+            if (!started) {
+                first = r.timestamp;
+                started = true;
+            }
+            // records of different cpus may be slightly out of order.
+            if (timed && r.timestamp > first &&
+                !sleep_until(ns_to_timestamp(begin + r.timestamp - first))) {
+                ok = false;
+                break;
+            }
+            // the trace may come from a larger image.
+            if ((usize)r.block_no + r.count > num_blocks)
+                continue;
+            for (usize k = 0; k < r.count; k += REPLAY_MAX_BLOCKS) {
+                ReplaySlot* s = &slots[next++ % REPLAY_DEPTH];
+                unalertable_wait_sem(&s->idle);
+                s->req = (BlockRequest){
+                    .block_no = r.block_no + k,
+                    .count = MIN((usize)r.count - k, (usize)REPLAY_MAX_BLOCKS),
+                    .buffer = replay_data,
+                    .write = false,
+                    .done = replay_done,
+                    .arg = s,
+                };
+                device.submit(&s->req);
+            }
+        }
+    }
+    for (int i = 0; i < REPLAY_DEPTH; i++)
+        unalertable_wait_sem(&slots[i].idle);
+    kfree_page(slots);
+    return ok ? (i64)(get_timestamp_ns() - begin) : -1;
+}
+
+static void traced_read(usize block_no, u8* buffer) {
+    trace_record(block_no, 1, BLOCK_TRACE_READ);
+    device.read(block_no, buffer);
+}
+
+static void traced_write(usize block_no, u8* buffer) {
+    trace_record(block_no, 1, BLOCK_TRACE_WRITE);
+    device.write(block_no, buffer);
+}
+
+static void traced_read_blocks(usize block_no, usize count, u8* buffer) {
+    trace_record(block_no, count, BLOCK_TRACE_READ);
+    device.read_blocks(block_no, count, buffer);
+}
+
+static void traced_write_blocks(usize block_no, usize count, u8* buffer) {
+    trace_record(block_no, count, BLOCK_TRACE_WRITE);
+    device.write_blocks(block_no, count, buffer);
+}
+
+static void traced_submit(BlockRequest* req) {
+    trace_record(req->block_no, req->count, req->write ? BLOCK_TRACE_WRITE : BLOCK_TRACE_READ);
+    device.submit(req);
+}
+
 void init_block_device() {
     // FIXME
-    sd_init();
-    sd_read(1, sblock_data);
-    block_device.read = sd_read;
-    block_device.write = sd_write;
+    if (USE_RAMDISK) {
+        usize size = ramdisk_size();
+        if (size == 0) {
+            printk("ramdisk: no file system image that fits below 0x%llx at 0x%llx\n",
+                   (u64)PHYSTOP, (u64)RAMDISK_BASE);
+            PANIC();
+        }
+        ramdisk = (u8*)P2K(RAMDISK_BASE);
+        ramdisk_blocks = size / BLOCK_SIZE;
+        printk("ramdisk: %llu blocks at 0x%llx\n", ramdisk_blocks, (u64)RAMDISK_BASE);
+        device.read = ram_read;
+        device.write = ram_write;
+        device.read_blocks = ram_read_blocks;
+        device.write_blocks = ram_write_blocks;
+        device.submit = ram_submit;
+    } else {
+        sd_init();
+        init_sem(&reserve_idle, 1);
+        device.read = sd_read;
+        device.write = sd_write;
+        device.read_blocks = sd_read_blocks;
+        device.write_blocks = sd_write_blocks;
+        device.submit = sd_submit_request;
+    }
+    if (USE_BLOCK_TRACE) {
+        init_spinlock(&trace.lock);
+        block_device.read = traced_read;
+        block_device.write = traced_write;
+        block_device.read_blocks = traced_read_blocks;
+        block_device.write_blocks = traced_write_blocks;
+        block_device.submit = traced_submit;
+    } else {
+        block_device = device;
+    }
+    block_device.read(1, sblock_data);
 	const SuperBlock* sb = get_super_block();
+	if (sb->magic != FS_MAGIC || sb->version != FS_VERSION || sb->block_size != BLOCK_SIZE) {
+		printk("bad super block: magic %x, version %d, block_size %d\n",
+		       sb->magic, sb->version, sb->block_size);
+		PANIC();
+	}
+	printk("version: %d\n", sb->version);
+	printk("block_size: %d\n", sb->block_size);
 	printk("num_blocks: %d\n",sb->num_blocks);
 	printk("num_data_blocks: %d\n", sb->num_data_blocks);
 	printk("num_inodes: %d\n", sb->num_inodes);
@@ -37,6 +392,7 @@ void init_block_device() {
 	printk("log_start: %d\n", sb->log_start);
 	printk("inode_start: %d\n", sb->inode_start);
 	printk("bitmap_start: %d\n", sb->bitmap_start);
+	printk("flags: %x\n", sb->flags);
 }
 
 const SuperBlock* get_super_block() {
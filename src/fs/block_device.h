@@ -2,6 +2,21 @@
 
 #include <fs/defines.h>
 
+// an asynchronous transfer of `count` consecutive blocks from `block_no` on.
+typedef struct BlockRequest {
+    usize block_no;
+    usize count;
+    u8* buffer;
+    bool write;
+
+    // called once the whole transfer is done, possibly from interrupt context.
+    void (*done)(struct BlockRequest* req);
+    void* arg;
+
+    // private to the device.
+    usize num_pending;
+} BlockRequest;
+
 typedef struct {
     // read `BLOCK_SIZE` bytes in block at `block_no` to `buffer`.
     // caller must guarantee `buffer` is large enough.
@@ -10,9 +25,70 @@ typedef struct {
     // write `BLOCK_SIZE` bytes from `buffer` to block at `block_no`.
     // caller must guarantee `buffer` contains at least `BLOCK_SIZE` bytes.
     void (*write)(usize block_no, u8* buffer);
+
+    // read `count` consecutive blocks from `block_no` on to `buffer`, in as
+    // few device commands as possible.
+    // caller must guarantee `buffer` holds `count * BLOCK_SIZE` bytes.
+    void (*read_blocks)(usize block_no, usize count, u8* buffer);
+
+    // write `count` consecutive blocks from `block_no` on from `buffer`.
+    // caller must guarantee `buffer` contains `count * BLOCK_SIZE` bytes.
+    void (*write_blocks)(usize block_no, usize count, u8* buffer);
+
+    // queue `req` and return at once. the device may reorder and merge
+    // requests that are outstanding together.
+    // caller must keep `req` and its buffer alive until `req->done` is called.
+    void (*submit)(BlockRequest* req);
 } BlockDevice;
 
 extern BlockDevice block_device;
 
 void init_block_device();
+
+// with the BLOCK_TRACE build option, every transfer through `block_device`
+// is recorded in a ring buffer of the last `BLOCK_TRACE_SIZE` ones. the
+// `blktrace` program dumps it to a file. `blktrace -r` replays a dump on the
+// device, through its request queue, and `trace_replay` in `fs/test` feeds
+// it back into the block cache on the host.
+#define BLOCK_TRACE_SIZE  4096
+#define BLOCK_TRACE_MAGIC 0x43525442  // "BTRC"
+#define BLOCK_TRACE_READ  0
+#define BLOCK_TRACE_WRITE 1
+
+typedef struct {
+    u64 timestamp;  // nanoseconds since boot, when the transfer was issued.
+    u32 block_no;
+    u32 count;      // number of consecutive blocks.
+    u16 op;         // `BLOCK_TRACE_READ` or `BLOCK_TRACE_WRITE`.
+    u16 cpu;
+    i32 pid;        // 0 if no process was running.
+} BlockTraceRecord;
+
+// a dump is a sequence of chunks, each of them a header followed by
+// `num_records` records.
+typedef struct {
+    u32 magic;  // must be `BLOCK_TRACE_MAGIC`.
+    u32 num_records;
+    u64 num_dropped;  // records overwritten since the previous chunk.
+    SuperBlock sblock;
+} BlockTraceHeader;
+
+// move the oldest records out of the trace into `buf` as one chunk of at
+// most `size` bytes. return the size of the chunk, 0 if there are no
+// records, or -1 if the kernel is built without BLOCK_TRACE.
+isize block_trace_dump(u8* buf, usize size);
+
+// issue the records of the dump in `dump` to the device, in order, through
+// `submit` with a bounded number outstanding, so that the SD card's elevator
+// sorts and merges them as it did the traced ones. writes are replayed as
+// reads of the same blocks, which leaves the disk as it is. if `timed`, a
+// record is issued no earlier than its offset in the trace. return the time
+// taken in nanoseconds, or -1 if the dump is malformed or the caller is
+// killed.
+i64 block_trace_replay(const u8* dump, usize size, bool timed);
+
+// size in bytes of the RAM disk image at RAMDISK_BASE, 0 if there is none
+// or the kernel is not built with the RAMDISK option. its memory is kept
+// out of the page allocator.
+usize ramdisk_size();
 const SuperBlock* get_super_block();
\ No newline at end of file
@@ -10,10 +10,12 @@ static const BlockDevice* device;
 
 static SpinLock lock;     // protects block cache.
 static ListNode head;     // the list of all allocated in-memory block.
-static LogHeader header;  // in-memory copy of log header block.
+static LogHeader header DMA_ALIGNED;  // in-memory copy of log header block.
 static Bitmap(swap_bitmap, SWAP_SIZE);
 static SpinLock swap_lock;
 
+#define LOG_FREED_MAX 64
+
 // hint: you may need some other variables. Just add them here.
 struct LOG {
     /* data */
@@ -24,8 +26,21 @@ struct LOG {
     u32 log_size;
     u32 outstanding;
     bool committing;
+    // blocks freed by the running transactions. They must not receive
+    // unlogged data before the free commits, see `cache_alloc_data`.
+    u32 num_freed;
+    u32 freed[LOG_FREED_MAX];
+    bool freed_overflow;
 } log;
 
+static usize alloc_hint;  // where the next bitmap scan starts.
+
+// the log is copied through `staging` so that runs of blocks that are
+// consecutive on disk go out together. only the committer (or
+// `init_bcache`) uses it.
+#define LOG_BATCH 16
+static u8 staging[LOG_BATCH * BLOCK_SIZE] DMA_ALIGNED;
+
 // read the content from disk.
 static INLINE void device_read(Block* block) {
     device->read(block->block_no, block->data);
@@ -55,7 +70,8 @@ static void init_block(Block* block) {
 
     init_sleeplock(&block->lock);
     block->valid = false;
-    memset(block->data, 0, sizeof(block->data));
+    block->data = kalloc_page();
+    memset(block->data, 0, BLOCK_SIZE);
 }
 
 // see `cache.h`.
@@ -99,6 +115,7 @@ start:
             Block* b = container_of(p, Block, node);
             if(!b->pinned && !b->acquired){
                 p = _detach_from_list(p);
+                kfree_page(b->data);
                 kfree(b);
                 cnum--;
             }else{
@@ -127,15 +144,60 @@ static void cache_release(Block* block) {
     _release_spinlock(&lock);
 }
 
+static void request_done(BlockRequest* req) {
+    post_sem((Semaphore*)req->arg);
+}
+
+// install the committed blocks at their home locations. up to LOG_BATCH
+// blocks are staged at once, and each run of blocks that are consecutive
+// on disk is one request; they are all outstanding together, so the
+// device can order and merge them.
 static void log_wb(){
-    for(usize i = 0; i < header.num_blocks; i++){
-        Block* logb = cache_acquire(sblock->log_start + i + 1);
-        Block* sdb = cache_acquire(header.block_no[i]);
-        memmove(sdb->data, logb->data, BLOCK_SIZE);
-        device_write(sdb);
-        sdb->pinned = false;
-        cache_release(logb);
-        cache_release(sdb);
+    for(usize i = 0; i < header.num_blocks;){
+        Block* sdb[LOG_BATCH];
+        BlockRequest req[LOG_BATCH];
+        Semaphore done;
+        init_sem(&done, 0);
+        usize n = MIN(header.num_blocks - i, (usize)LOG_BATCH);
+        usize num_req = 0;
+        for(usize k = 0; k < n; k++){
+            sdb[k] = cache_acquire(header.block_no[i + k]);
+            memmove(staging + k * BLOCK_SIZE, sdb[k]->data, BLOCK_SIZE);
+            if(k > 0 && header.block_no[i + k] == header.block_no[i + k - 1] + 1){
+                req[num_req - 1].count++;
+                continue;
+            }
+            req[num_req++] = (BlockRequest){
+                .block_no = header.block_no[i + k],
+                .count = 1,
+                .buffer = staging + k * BLOCK_SIZE,
+                .write = true,
+                .done = request_done,
+                .arg = &done,
+            };
+        }
+        for(usize r = 0; r < num_req; r++)
+            device->submit(&req[r]);
+        for(usize r = 0; r < num_req; r++)
+            unalertable_wait_sem(&done);
+        // unpinned only now, so they are not evicted and read back stale.
+        for(usize k = 0; k < n; k++){
+            sdb[k]->pinned = false;
+            cache_release(sdb[k]);
+        }
+        i += n;
+    }
+    header.num_blocks = 0;
+    write_header();
+}
+
+// replay a log left by a crash, straight from the disk.
+static void log_recover(){
+    for(usize i = 0; i < header.num_blocks; i += LOG_BATCH){
+        usize n = MIN(header.num_blocks - i, (usize)LOG_BATCH);
+        device->read_blocks(sblock->log_start + 1 + i, n, staging);
+        for(usize k = 0; k < n; k++)
+            device->write(header.block_no[i + k], staging + k * BLOCK_SIZE);
     }
     header.num_blocks = 0;
     write_header();
@@ -157,28 +219,38 @@ void init_bcache(const SuperBlock* _sblock, const BlockDevice* _device) {
     log.log_size = MIN(LOG_MAX_SIZE, sblock->num_log_blocks - 1);
     log.outstanding = 0;
     log.committing = false;
+    log.num_freed = 0;
+    log.freed_overflow = false;
+    alloc_hint = 0;
 
     read_header();
-    log_wb();
+    log_recover();
 
     memset(swap_bitmap, 0, sizeof(swap_bitmap));
     init_spinlock(&swap_lock);
 }
 
 // see `cache.h`.
-static void cache_begin_op(OpContext* ctx) {
+static usize cache_begin_large_op(OpContext* ctx, usize num_blocks) {
     // TODO
+    num_blocks = MIN(MAX(num_blocks, (usize)OP_MAX_NUM_BLOCKS), (usize)log.log_size);
     _acquire_spinlock(&log.lock);
-    while(log.log_used + OP_MAX_NUM_BLOCKS > log.log_size || log.committing){
+    while(log.log_used + num_blocks > log.log_size || log.committing){
         _lock_sem(&log.begin);
         _release_spinlock(&log.lock);
         ASSERT(_wait_sem(&log.begin, false));
         _acquire_spinlock(&log.lock);
     }
-    ctx->rm = OP_MAX_NUM_BLOCKS;
-    log.log_used += OP_MAX_NUM_BLOCKS;
+    ctx->rm = num_blocks;
+    log.log_used += num_blocks;
     log.outstanding++;
     _release_spinlock(&log.lock);
+    return num_blocks;
+}
+
+// see `cache.h`.
+static void cache_begin_op(OpContext* ctx) {
+    cache_begin_large_op(ctx, OP_MAX_NUM_BLOCKS);
 }
 
 // see `cache.h`.
@@ -215,17 +287,21 @@ static void cache_end_op(OpContext* ctx) {
     if(log.outstanding == 0){
         log.committing = true;
         _release_spinlock(&log.lock);
-        for(usize i = 0; i < header.num_blocks; i++){
-            Block* logb = cache_acquire(sblock->log_start + i + 1);
-            Block* sdb = cache_acquire(header.block_no[i]);
-            memmove(logb->data, sdb->data, BLOCK_SIZE);
-            device_write(logb);
-            cache_release(logb);
-            cache_release(sdb);
+        // the log area is written around the cache, LOG_BATCH blocks at a time.
+        for(usize i = 0; i < header.num_blocks; i += LOG_BATCH){
+            usize n = MIN(header.num_blocks - i, (usize)LOG_BATCH);
+            for(usize k = 0; k < n; k++){
+                Block* sdb = cache_acquire(header.block_no[i + k]);
+                memmove(staging + k * BLOCK_SIZE, sdb->data, BLOCK_SIZE);
+                cache_release(sdb);
+            }
+            device->write_blocks(sblock->log_start + 1 + i, n, staging);
         }
         write_header();
         log.log_used -= header.num_blocks;
         log_wb();
+        log.num_freed = 0;
+        log.freed_overflow = false;
         log.committing = false;
         _acquire_spinlock(&log.lock);
         post_all_sem(&log.end);
@@ -239,35 +315,126 @@ static void cache_end_op(OpContext* ctx) {
     }
 }
 
-// see `cache.h`.
-// hint: you can use `cache_acquire`/`cache_sync` to read/write blocks.
-static usize cache_alloc(OpContext* ctx) {
-    // TODO
-    for(u32 i = 0; i < SWAP_START; i += BIT_PER_BLOCK){
-        Block* b = cache_acquire(sblock->bitmap_start + i / BIT_PER_BLOCK);
-        BitmapCell* bm = (BitmapCell*)b->data;
-        for(u32 j = 0; j < BIT_PER_BLOCK && i + j < SWAP_START; j++){
-            if(!bitmap_get(bm, j)){
-                bitmap_set(bm, j);
-                cache_sync(ctx, b);
+// a copy of `log.freed`, so that a bitmap scan takes `log.lock` once per
+// bitmap block instead of once per candidate.
+typedef struct {
+    u32 num;
+    bool overflow;
+    u32 block_no[LOG_FREED_MAX];
+} FreedSet;
+
+// take the copy while holding the bitmap block being scanned: `cache_free`
+// records a block before it clears its bit, so none of the free bits seen
+// in that block can be missing from the copy.
+static void snapshot_freed(FreedSet* set) {
+    _acquire_spinlock(&log.lock);
+    set->num = log.num_freed;
+    set->overflow = log.freed_overflow;
+    memmove(set->block_no, log.freed, set->num * sizeof(u32));
+    _release_spinlock(&log.lock);
+}
+
+static bool in_freed(const FreedSet* set, usize block_no) {
+    for(u32 i = 0; i < set->num; i++){
+        if(set->block_no[i] == block_no)
+            return true;
+    }
+    return false;
+}
+
+// find a free block in the bitmap and mark it used. The scan is next-fit:
+// it starts where the last one stopped, so a burst of allocations gets
+// consecutive blocks without rescanning the used prefix of the disk.
+// if `freed` is not NULL, blocks freed by the running transactions are
+// skipped, as far as `freed->overflow` says they are all known.
+static usize bitmap_alloc(OpContext* ctx, FreedSet* freed) {
+    usize num = sblock->num_blocks;
+    usize start = __atomic_load_n(&alloc_hint, __ATOMIC_RELAXED) % num;
+    Block* b = NULL;
+    for(usize k = 0; k < num; k++){
+        usize i = (start + k) % num;
+        usize bno = sblock->bitmap_start + i / BIT_PER_BLOCK;
+        if(b == NULL || b->block_no != bno){
+            if(b != NULL)
                 cache_release(b);
-                Block* new = cache_acquire(i + j);
-                memset(new->data, 0, BLOCK_SIZE);
-                cache_sync(ctx, new);
-                cache_release(new);
-                return i + j;
-            }
+            b = cache_acquire(bno);
+            if(freed != NULL)
+                snapshot_freed(freed);
+        }
+        BitmapCell* bm = (BitmapCell*)b->data;
+        usize j = i % BIT_PER_BLOCK;
+        if(j % BITMAP_BITS_PER_CELL == 0 && bm[j / BITMAP_BITS_PER_CELL] == ~(BitmapCell)0
+           && i + BITMAP_BITS_PER_CELL <= num){
+            k += BITMAP_BITS_PER_CELL - 1;
+            continue;
         }
+        if(bitmap_get(bm, j) || (freed != NULL && in_freed(freed, i)))
+            continue;
+        bitmap_set(bm, j);
+        cache_sync(ctx, b);
         cache_release(b);
+        __atomic_store_n(&alloc_hint, i + 1, __ATOMIC_RELAXED);
+        return i;
     }
+    if(b != NULL)
+        cache_release(b);
     PANIC();
 }
 
+// zero the newly allocated block `block_no` through `ctx`.
+static void zero_block(OpContext* ctx, usize block_no) {
+    Block* new = cache_acquire(block_no);
+    memset(new->data, 0, BLOCK_SIZE);
+    cache_sync(ctx, new);
+    cache_release(new);
+}
+
+// see `cache.h`.
+// hint: you can use `cache_acquire`/`cache_sync` to read/write blocks.
+static usize cache_alloc(OpContext* ctx) {
+    // TODO
+    usize i = bitmap_alloc(ctx, NULL);
+    zero_block(ctx, i);
+    return i;
+}
+
+// see `cache.h`.
+static usize cache_alloc_data(OpContext* ctx) {
+    if(ctx == NULL)
+        return cache_alloc(ctx);
+    FreedSet freed;
+    usize i = bitmap_alloc(ctx, &freed);
+    // too many frees to tell whether the block is one of them. reusing it
+    // is only safe through the log, since a crash before the free commits
+    // would expose the new data in the old file: `cache_sync_data` keeps
+    // it there once it is logged here.
+    if(freed.overflow)
+        zero_block(ctx, i);
+    return i;
+}
+
+// see `cache.h`.
+static void cache_sync_data(OpContext* ctx, Block* block) {
+    _acquire_spinlock(&log.lock);
+    bool logged = block->pinned;
+    _release_spinlock(&log.lock);
+    cache_sync(logged ? ctx : NULL, block);
+}
+
 // see `cache.h`.
 // hint: you can use `cache_acquire`/`cache_sync` to read/write blocks.
 static void cache_free(OpContext* ctx, usize block_no) {
     // TODO
     Block* b = cache_acquire(sblock->bitmap_start + block_no / BIT_PER_BLOCK);
+    // recorded before the bit is cleared, see `snapshot_freed`.
+    if(ctx){
+        _acquire_spinlock(&log.lock);
+        if(log.num_freed < LOG_FREED_MAX)
+            log.freed[log.num_freed++] = block_no;
+        else
+            log.freed_overflow = true;
+        _release_spinlock(&log.lock);
+    }
     BitmapCell* bm = (BitmapCell*)b->data;
     bitmap_clear(bm, block_no % BIT_PER_BLOCK);
     cache_sync(ctx, b);
@@ -275,19 +442,19 @@ static void cache_free(OpContext* ctx, usize block_no) {
 }
 
 //swap
-void release_8_blocks(u32 bno){
+void release_swap_block(u32 bno){
     _acquire_spinlock(&swap_lock);
-    bitmap_clear(swap_bitmap, (bno - SWAP_START) / 8);
+    bitmap_clear(swap_bitmap, bno - SWAP_START);
     _release_spinlock(&swap_lock);
 }
 
-u32 find_and_set_8_blocks(){
+u32 find_and_set_swap_block(){
     _acquire_spinlock(&swap_lock);
     for(u32 i = 0; i < SWAP_SIZE; i++){
         if(!bitmap_get(swap_bitmap, i)){
             bitmap_set(swap_bitmap, i);
             _release_spinlock(&swap_lock);
-            return SWAP_START + i*8;
+            return SWAP_START + i;
         }
     }
     _release_spinlock(&swap_lock);
@@ -299,8 +466,11 @@ BlockCache bcache = {
     .acquire = cache_acquire,
     .release = cache_release,
     .begin_op = cache_begin_op,
+    .begin_large_op = cache_begin_large_op,
     .sync = cache_sync,
+    .sync_data = cache_sync_data,
     .end_op = cache_end_op,
     .alloc = cache_alloc,
+    .alloc_data = cache_alloc_data,
     .free = cache_free,
 };
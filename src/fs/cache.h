@@ -11,10 +11,6 @@
 // evict some blocks in `acquire` to keep block cache small.
 #define EVICTION_THRESHOLD 20
 
-#define SWAP_START 800
-#define SWAP_END 1000
-#define SWAP_SIZE 25
-
 // hint: `cache_test` only requires `block_no`, `valid` and `data` are present
 // in this struct. All other struct members can be customized by yourself.
 // for example, if you want to implement LFU strategy instead, you can add a
@@ -30,7 +26,7 @@ typedef struct {
     Semaphore sem;  // this lock protects `valid` and `data`.
     SleepLock lock;
     bool valid;  // is the content of block loaded from disk?
-    u8 data[BLOCK_SIZE];
+    u8* data;  // `BLOCK_SIZE` bytes, a page from `kalloc_page`.
 } Block;
 
 // `OpContext` represents an atomic operation.
@@ -71,6 +67,12 @@ typedef struct BlockCache {
     // end of atomic operation by `end_op`.
     void (*begin_op)(OpContext* ctx);
 
+    // like `begin_op`, but reserve room for `num_blocks` blocks in the log
+    // instead of `OP_MAX_NUM_BLOCKS`, so that one atomic operation can cover
+    // a large write. the reservation is capped by the size of the log.
+    // return the number of blocks actually reserved.
+    usize (*begin_large_op)(OpContext* ctx, usize num_blocks);
+
     // synchronize the content of `block` to disk.
     // `ctx` can be NULL, which indicates this operation does not belong to any
     // atomic operation and it immediately writes block content back to disk.
@@ -102,6 +104,19 @@ typedef struct BlockCache {
     // NOTE: if there's no free block on disk, `alloc` should panic.
     usize (*alloc)(OpContext* ctx);
 
+    // allocate a block for file data that will be written around the log
+    // (ordered-data mode). unlike `alloc`, the block is usually neither
+    // zeroed nor logged: the caller must fill all of it and write it with
+    // `sync_data` before `end_op`. a block freed by a transaction that has
+    // not committed yet is only returned zeroed and logged, like `alloc`.
+    usize (*alloc_data)(OpContext* ctx);
+
+    // write a block from `alloc_data` to disk around the log, unless it
+    // already belongs to the log, in which case it is the same as `sync`.
+    //
+    // NOTE: the caller must hold the lock of `block`.
+    void (*sync_data)(OpContext* ctx, Block* block);
+
     // mark block at `block_no` is free in bitmap.
     void (*free)(OpContext* ctx, usize block_no);
 } BlockCache;
@@ -111,5 +126,5 @@ extern BlockCache bcache;
 void init_bcache(const SuperBlock* sblock, const BlockDevice* device);
 usize BBLOCK(usize block_no, const SuperBlock* sb);
 void bzero(OpContext* ctx, u32 block_no);
-void release_8_blocks(u32 bno);
-u32 find_and_set_8_blocks();
+void release_swap_block(u32 bno);
+u32 find_and_set_swap_block();
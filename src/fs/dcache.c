@@ -0,0 +1,113 @@
+#include <common/seqlock.h>
+#include <common/string.h>
+#include <fs/dcache.h>
+
+#define DCACHE_NUM_BUCKETS     256
+#define DCACHE_NUM_WAYS        4
+#define DCACHE_NUM_GENERATIONS 1024
+
+typedef struct {
+    u32 parent;      // 0 if this entry is empty.
+    u32 inode_no;    // 0 for a negative entry.
+    u32 generation;  // of `parent` when the entry was recorded.
+    char name[FILE_NAME_MAX_LENGTH];
+} Dentry;
+
+// entries are never freed, so that lock-free readers only need to copy them
+// under the sequence lock of their bucket.
+typedef struct {
+    SeqLock lock;
+    usize victim;  // the way to be replaced next.
+    Dentry entries[DCACHE_NUM_WAYS];
+} DcacheBucket;
+
+static DcacheBucket buckets[DCACHE_NUM_BUCKETS];
+
+// an entry only counts while the generation of its directory is the one it
+// was recorded under, so purging a directory is a single increment rather
+// than a sweep of every bucket. directories that share a generation purge
+// each other, which only costs misses.
+static u32 generations[DCACHE_NUM_GENERATIONS];
+
+static INLINE u32 generation(usize parent) {
+    return __atomic_load_n(&generations[parent % DCACHE_NUM_GENERATIONS], __ATOMIC_ACQUIRE);
+}
+
+void init_dcache() {
+    memset(generations, 0, sizeof(generations));
+    for (usize i = 0; i < DCACHE_NUM_BUCKETS; i++) {
+        init_seqlock(&buckets[i].lock);
+        buckets[i].victim = 0;
+        memset(buckets[i].entries, 0, sizeof(buckets[i].entries));
+    }
+}
+
+// FNV-1a hash.
+u32 name_hash(const char* name) {
+    u32 hash = 2166136261u;
+    for (usize i = 0; i < FILE_NAME_MAX_LENGTH && name[i]; i++) {
+        hash ^= (u8)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static INLINE DcacheBucket* to_bucket(usize parent, const char* name) {
+    return &buckets[(name_hash(name) ^ (parent * 2654435761u)) % DCACHE_NUM_BUCKETS];
+}
+
+static INLINE bool match(Dentry* d, usize parent, const char* name) {
+    return d->parent == parent && strncmp(d->name, name, FILE_NAME_MAX_LENGTH) == 0;
+}
+
+bool dcache_lookup(usize parent, const char* name, usize* inode_no) {
+    auto b = to_bucket(parent, name);
+    u32 gen = generation(parent);
+    bool hit;
+    u32 result, seq;
+    do {
+        seq = read_seqbegin(&b->lock);
+        hit = false;
+        result = 0;
+        for (usize i = 0; i < DCACHE_NUM_WAYS; i++) {
+            if (match(&b->entries[i], parent, name) && b->entries[i].generation == gen) {
+                hit = true;
+                result = b->entries[i].inode_no;
+                break;
+            }
+        }
+    } while (read_seqretry(&b->lock, seq));
+
+    if (hit)
+        *inode_no = result;
+    return hit;
+}
+
+void dcache_update(usize parent, const char* name, usize inode_no) {
+    auto b = to_bucket(parent, name);
+    write_seqlock(&b->lock);
+    Dentry* d = NULL;
+    for (usize i = 0; i < DCACHE_NUM_WAYS && d == NULL; i++) {
+        if (match(&b->entries[i], parent, name))
+            d = &b->entries[i];
+    }
+    // empty entries, or ones purged with their directory.
+    for (usize i = 0; i < DCACHE_NUM_WAYS && d == NULL; i++) {
+        auto e = &b->entries[i];
+        if (e->parent == 0 || e->generation != generation(e->parent))
+            d = e;
+    }
+    if (d == NULL) {
+        d = &b->entries[b->victim];
+        b->victim = (b->victim + 1) % DCACHE_NUM_WAYS;
+    }
+    d->parent = (u32)parent;
+    d->inode_no = (u32)inode_no;
+    d->generation = generation(parent);
+    strncpy(d->name, name, FILE_NAME_MAX_LENGTH);
+    write_sequnlock(&b->lock);
+}
+
+void dcache_purge(usize parent) {
+    __atomic_add_fetch(&generations[parent % DCACHE_NUM_GENERATIONS], 1, __ATOMIC_RELEASE);
+}
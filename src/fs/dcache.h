@@ -0,0 +1,26 @@
+#pragma once
+
+#include <fs/defines.h>
+
+// the dentry cache remembers results of directory lookups, keyed by the
+// inode number of the parent directory and the file name. A cached
+// `inode_no` of 0 means that the name does not exist in the directory.
+//
+// the inode layer keeps it consistent: `inode_lookup`, `inode_insert` and
+// `inode_remove` update it while holding the lock of the directory.
+
+void init_dcache();
+
+// hash of a file name, which is at most `FILE_NAME_MAX_LENGTH` characters.
+u32 name_hash(const char* name);
+
+// look up `name` in directory `parent`. Return true and set `*inode_no` if
+// the result is cached. It does not take any lock.
+bool dcache_lookup(usize parent, const char* name, usize* inode_no);
+
+// record that `name` in directory `parent` refers to `inode_no`, or does not
+// exist if `inode_no` is 0.
+void dcache_update(usize parent, const char* name, usize inode_no);
+
+// forget all names in directory `parent`. It does not take any lock.
+void dcache_purge(usize parent);
@@ -6,16 +6,28 @@
  * this file contains on-disk representations of primitives in our filesystem.
  */
 
-#define BLOCK_SIZE 512
+// a block is the unit of the filesystem, the block cache and swap, and it
+// is exactly one page. It is made up of consecutive sectors on SD card.
+#define BLOCK_SIZE        4096
+#define SECTOR_SIZE       512
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
+
+// `SuperBlock.magic` and `SuperBlock.version` of images generated by `mkfs`.
+// version 1 was the unversioned format with 512-byte blocks.
+#define FS_MAGIC   0x53464446  // "FDFS"
+#define FS_VERSION 2
 
 // maximum number of distinct block numbers can be recorded in the log header.
 #define LOG_MAX_SIZE ((BLOCK_SIZE - sizeof(usize)) / sizeof(usize))
 
-#define INODE_NUM_DIRECT   12
-#define INODE_NUM_INDIRECT (BLOCK_SIZE / sizeof(u32))
-#define INODE_PER_BLOCK    (BLOCK_SIZE / sizeof(InodeEntry))
-#define INODE_MAX_BLOCKS   (INODE_NUM_DIRECT + INODE_NUM_INDIRECT)
-#define INODE_MAX_BYTES    (INODE_MAX_BLOCKS * BLOCK_SIZE)
+#define INODE_NUM_DIRECT    11
+#define INODE_NUM_INDIRECT  (BLOCK_SIZE / sizeof(u32))
+#define INODE_NUM_DINDIRECT (INODE_NUM_INDIRECT * INODE_NUM_INDIRECT)
+#define INODE_PER_BLOCK     (BLOCK_SIZE / sizeof(InodeEntry))
+#define INODE_MAX_BLOCKS    (INODE_NUM_DIRECT + INODE_NUM_INDIRECT + INODE_NUM_DINDIRECT)
+// `InodeEntry.num_bytes` is 32-bit, so files stay below 4 GiB even though
+// the block pointers can address more.
+#define INODE_MAX_BYTES     MIN(INODE_MAX_BLOCKS * BLOCK_SIZE, (usize)(u32)-1)
 
 // the maximum length of file names, including trailing '\0'.
 #define FILE_NAME_MAX_LENGTH 14
@@ -38,6 +50,9 @@ typedef u16 InodeType;
 // `mkfs` generates the super block and builds an initial filesystem. The
 // super block describes the disk layout.
 typedef struct {
+    u32 magic;       // must be `FS_MAGIC`.
+    u32 version;     // on-disk format version, must be `FS_VERSION`.
+    u32 block_size;  // size of a block in bytes, must be `BLOCK_SIZE`.
     u32 num_blocks;  // total number of blocks in filesystem.
     u32 num_data_blocks;
     u32 num_inodes;
@@ -45,8 +60,13 @@ typedef struct {
     u32 log_start;       // the first block of logging area.
     u32 inode_start;     // the first block of inode area.
     u32 bitmap_start;    // the first block of bitmap area.
+    u32 flags;           // `SB_*` below. zero on images made before it existed.
 } SuperBlock;
 
+// regular file data is written in place before the atomic operation that
+// wrote it commits, and only metadata goes through the log. set by `mkfs -o`.
+#define SB_ORDERED_DATA 0x1
+
 // `type == INODE_INVALID` implies this inode is free.
 typedef struct dinode {
     InodeType type;
@@ -56,9 +76,11 @@ typedef struct dinode {
     u32 num_bytes;                // number of bytes in the file, i.e. the size of file.
     u32 addrs[INODE_NUM_DIRECT];  // direct addresses/block numbers.
     u32 indirect;                 // the indirect address block.
+    u32 double_indirect;          // the block of indirect address blocks.
 } InodeEntry;
 
-// the block pointed by `InodeEntry.indirect`.
+// the block pointed by `InodeEntry.indirect`, and also the blocks pointed by
+// `InodeEntry.double_indirect` and its entries.
 typedef struct {
     u32 addrs[INODE_NUM_INDIRECT];
 } IndirectBlock;
@@ -74,5 +96,11 @@ typedef struct {
     usize block_no[LOG_MAX_SIZE];
 } LogHeader;
 
+// swap area, reserved in the block bitmap by `mkfs` so that it is never
+// handed out by `BlockCache.alloc`. One page takes one block.
+#define SWAP_START 800
+#define SWAP_END   1000
+#define SWAP_SIZE  (SWAP_END - SWAP_START)
+
 // mkfs only
-#define FSSIZE 1000  // Size of file system in blocks
\ No newline at end of file
+#define FSSIZE 16000  // Size of file system in blocks, fits the SD partition
\ No newline at end of file
@@ -7,14 +7,16 @@
 #include <fs/inode.h>
 #include <common/list.h>
 #include <kernel/mem.h>
+#include <common/string.h>
 #include "fs.h"
 #include "pipe.h"
+#include <kernel/console.h>
 
 static struct ftable ftable;
 
 void init_ftable() {
     // TODO: initialize your ftable
-    init_spinlock(&ftable.lock);
+    init_rc(&ftable.num_files);
 }
 
 void init_oftable(struct oftable *oftable) {
@@ -22,53 +24,99 @@ void init_oftable(struct oftable *oftable) {
     for(int i=0; i<NOFILE; i++){
         oftable->fp[i] = NULL;
     }
+    memset(oftable->used, 0, sizeof(oftable->used));
+    oftable->next_fd = 0;
+}
+
+int alloc_fd(struct oftable* oftable, struct file* f) {
+    for(int i = oftable->next_fd / BITMAP_BITS_PER_CELL; i < (int)BITMAP_TO_NUM_CELLS(NOFILE); i++){
+        BitmapCell free = ~oftable->used[i];
+        if(free == 0) continue;
+        int fd = i * BITMAP_BITS_PER_CELL + __builtin_ctzll(free);
+        if(fd >= NOFILE) break;
+        bitmap_set(oftable->used, fd);
+        oftable->fp[fd] = f;
+        oftable->next_fd = fd + 1;
+        return fd;
+    }
+    oftable->next_fd = NOFILE;
+    return -1;
+}
+
+struct file* free_fd(struct oftable* oftable, int fd) {
+    if(fd < 0 || fd >= NOFILE || oftable->fp[fd] == NULL)
+        return NULL;
+    struct file* f = oftable->fp[fd];
+    oftable->fp[fd] = NULL;
+    bitmap_clear(oftable->used, fd);
+    if(fd < oftable->next_fd)
+        oftable->next_fd = fd;
+    return f;
+}
+
+void close_oftable(struct oftable* oftable) {
+    for(int i = 0; i < (int)BITMAP_TO_NUM_CELLS(NOFILE); i++){
+        while(oftable->used[i])
+            fileclose(free_fd(oftable, i * BITMAP_BITS_PER_CELL + __builtin_ctzll(oftable->used[i])));
+    }
+}
+
+void dup_oftable(struct oftable* dst, struct oftable* src) {
+    *dst = *src;
+    for(int i = 0; i < NOFILE; i++){
+        if(dst->fp[i])
+            filedup(dst->fp[i]);
+    }
 }
 
 /* Allocate a file structure. */
 struct file* filealloc() {
     /* TODO: Lab10 Shell */
-    _acquire_spinlock(&ftable.lock);
-    for(int i=0; i<NOFILE; i++){
-        if(ftable.file[i].ref <= 0){
-            ftable.file[i].ref = 1;
-            _release_spinlock(&ftable.lock);
-            return &ftable.file[i];
-        }
+    // the count includes this file once it is incremented, so at most
+    // NFILE callers see it within the limit at a time.
+    _increment_rc(&ftable.num_files);
+    if(__atomic_load_n(&ftable.num_files.count, __ATOMIC_ACQUIRE) > NFILE){
+        _decrement_rc(&ftable.num_files);
+        return NULL;
     }
-    _release_spinlock(&ftable.lock);
-    return NULL;
+    struct file* f = kalloc(sizeof(struct file));
+    memset(f, 0, sizeof(struct file));
+    f->ref.count = 1;
+    return f;
 }
 
 /* Increment ref count for file f. */
 struct file* filedup(struct file* f) {
     /* TODO: Lab10 Shell */
-    _acquire_spinlock(&ftable.lock);
-    f->ref++;
-    _release_spinlock(&ftable.lock);
+    _increment_rc(&f->ref);
     return f;
 }
 
 /* Close file f. (Decrement ref count, close when reaches 0.) */
 void fileclose(struct file* f) {
     /* TODO: Lab10 Shell */
-    _acquire_spinlock(&ftable.lock);
-    f->ref--;
-    if(f->ref == 0){
-        if(f->type == FD_INODE){
-            Inode* inode = f->ip;
-            f->type = FD_NONE;
-            _release_spinlock(&ftable.lock);
-            OpContext ctx;
-            bcache.begin_op(&ctx);
-            inodes.put(&ctx, inode);
-            bcache.end_op(&ctx);
-        }else if(f->type == FD_PIPE){
-            pipeClose(f->pipe, f->writable);
-            _release_spinlock(&ftable.lock);
-        }
+    if(!_decrement_rc(&f->ref))
         return;
+    if(f->type == FD_INODE){
+        // whatever this file buffered goes out with it, so that the last
+        // `put` of the inode has nothing left to flush in a small operation.
+        // the data of an unlinked file is dropped with it instead.
+        if(f->writable){
+            inodes.lock(f->ip);
+            bool linked = f->ip->entry.num_links > 0;
+            inodes.unlock(f->ip);
+            if(linked)
+                fileflush(f);
+        }
+        OpContext ctx;
+        bcache.begin_op(&ctx);
+        inodes.put(&ctx, f->ip);
+        bcache.end_op(&ctx);
+    }else if(f->type == FD_PIPE){
+        pipeClose(f->pipe, f->writable);
     }
-    _release_spinlock(&ftable.lock);
+    kfree(f);
+    _decrement_rc(&ftable.num_files);
 }
 
 /* Get metadata about file f. */
@@ -79,6 +127,11 @@ int filestat(struct file* f, struct stat* st) {
         stati(f->ip, st);
         inodes.unlock(f->ip);
         return 0;
+    }else if(f->type == FD_PIPE){
+        memset(st, 0, sizeof(*st));
+        st->st_mode = S_IFIFO;
+        st->st_size = f->pipe->nwrite - f->pipe->nread;
+        return 0;
     }
     return -1;
 }
@@ -98,25 +151,167 @@ isize fileread(struct file* f, char* addr, isize n) {
     return -1;
 }
 
+// log blocks an atomic write needs whatever its size: the two partially
+// written blocks at its ends, and the inode, indirect and bitmap blocks
+// that the first data block may already bring in.
+#define WRITE_OP_FIXED_BLOCKS 9
+
+// number of log blocks an atomic write of `n` bytes may touch: its data
+// blocks, plus the indirect, bitmap and inode blocks it may modify.
+static usize write_op_blocks(usize n) {
+    usize d = n / BLOCK_SIZE + 2;
+    return n / BLOCK_SIZE + d / INODE_NUM_INDIRECT + d / BIT_PER_BLOCK
+           + WRITE_OP_FIXED_BLOCKS;
+}
+
+/* Write n bytes at f->off through the log, in as few operations as fit. */
+static isize write_logged(struct file* f, char* addr, isize n) {
+    isize count = 0;
+    while(count < n){
+        // one atomic operation sized to the write, as far as the log allows.
+        OpContext ctx;
+        usize got = bcache.begin_large_op(&ctx, write_op_blocks(n - count));
+        usize t = MIN((usize)(n - count), (got - WRITE_OP_FIXED_BLOCKS) * BLOCK_SIZE);
+        while(write_op_blocks(t) > got)
+            t -= BLOCK_SIZE;
+        inodes.lock(f->ip);
+        t = inodes.write(&ctx, f->ip, (u8*)addr + count, f->off, t);
+        f->off += t;
+        inodes.unlock(f->ip);
+        bcache.end_op(&ctx);
+        if(t == 0)
+            break;
+        count += t;
+    }
+    return count;
+}
+
+/* Give the delayed data of file f its blocks. */
+void fileflush(struct file* f) {
+    if(f->type != FD_INODE)
+        return;
+    inodes.lock(f->ip);
+    bool delayed = f->ip->delayed != NULL;
+    inodes.unlock(f->ip);
+    if(!delayed)
+        return;
+    OpContext ctx;
+    bcache.begin_large_op(&ctx, write_op_blocks(INODE_MAX_DELAYED_BLOCKS * BLOCK_SIZE));
+    inodes.lock(f->ip);
+    inodes.flush(&ctx, f->ip);
+    inodes.unlock(f->ip);
+    bcache.end_op(&ctx);
+}
+
 /* Write to file f. */
 isize filewrite(struct file* f, char* addr, isize n) {
     /* TODO: Lab10 Shell */
     if(f->type == FD_INODE && f->writable){
-        usize mx = (OP_MAX_NUM_BLOCKS-1-1-2) / 2 * BLOCK_SIZE;
-        isize t = 0;
-        while(t < n){
-            t = MIN(mx, (usize)n-t);
-            OpContext ctx;
-            bcache.begin_op(&ctx);
+        if(f->ip->entry.type != INODE_REGULAR)
+            return write_logged(f, addr, n);
+        // appends are buffered without touching the log; they get their
+        // blocks when the buffer fills up or the file is closed.
+        isize count = 0;
+        while(count < n){
+            usize alloc_end;
             inodes.lock(f->ip);
-            t = inodes.write(&ctx, f->ip, (u8*)addr, f->off, t);
+            usize t = inodes.write_delayed(f->ip, (u8*)addr + count, f->off,
+                                           n - count, &alloc_end);
             f->off += t;
+            usize off = f->off;
+            bool full = f->ip->delayed != NULL;
             inodes.unlock(f->ip);
-            bcache.end_op(&ctx);
+            count += t;
+            if(t > 0)
+                continue;
+            if(off < alloc_end){
+                // rewriting allocated blocks goes straight through the log.
+                isize m = MIN((usize)(n - count), alloc_end - off);
+                t = write_logged(f, addr + count, m);
+                count += t;
+                if(t != (usize)m)
+                    break;
+            }else if(full){
+                fileflush(f);
+            }else if(off < INODE_MAX_BYTES){
+                // no page to buffer in: write through the log instead.
+                t = write_logged(f, addr + count,
+                                 MIN((usize)(n - count), INODE_MAX_BYTES - off));
+                count += t;
+                if(t == 0)
+                    break;
+            }else{
+                break;
+            }
         }
-        return t;
+        return count;
     }else if(f->type == FD_PIPE && f->writable){
         return pipeWrite(f->pipe, (u64)addr, n);
     }
     return -1;
 }
+
+// takes no sleep lock, as `read_to` requires.
+static usize console_sink(void* arg, u8* data, usize n) {
+    (void)arg;
+    console_output((char*)data, n);
+    return n;
+}
+
+/* Move data from file in to file out without a user buffer. */
+isize filesend(struct file* out, struct file* in, usize* off, isize n) {
+    if(in->type != FD_INODE || !in->readable || !out->writable || n < 0)
+        return -1;
+    InodeSink sink = NULL;
+    if(out->type == FD_INODE && out->ip->entry.type == INODE_DEVICE){
+        sink = console_sink;
+    }else if(out->type != FD_INODE && out->type != FD_PIPE){
+        return -1;
+    }
+
+    inodes.lock(in->ip);
+    if(in->ip->entry.type != INODE_REGULAR){
+        inodes.unlock(in->ip);
+        return -1;
+    }
+    if(*off >= in->ip->entry.num_bytes){
+        inodes.unlock(in->ip);
+        return 0;
+    }
+    if(sink){
+        // the cached blocks go straight to the uart, which never waits on
+        // a reader.
+        n = inodes.read_to(in->ip, *off, n, sink, NULL);
+        *off += n;
+        inodes.unlock(in->ip);
+        return n;
+    }
+    inodes.unlock(in->ip);
+
+    // regular files and pipes are written through one kernel page, with
+    // neither the inode nor a block held: a pipe may wait on its reader
+    // for as long as it likes. this is not zero-copy: the data is copied
+    // out of the cache and again into the pipe, and only the trip through
+    // user memory is saved.
+    char* page = kalloc_page();
+    if(page == NULL)
+        return -1;
+    isize count = 0;
+    while(count < n){
+        isize want = MIN(PAGE_SIZE, n - count);
+        inodes.lock(in->ip);
+        isize t = 0;
+        if(*off < in->ip->entry.num_bytes)
+            t = inodes.read(in->ip, (u8*)page, *off, want);
+        inodes.unlock(in->ip);
+        if(t <= 0)
+            break;
+        t = MAX(filewrite(out, page, t), 0);
+        *off += t;
+        count += t;
+        if(t != want)
+            break;
+    }
+    kfree_page(page);
+    return count;
+}
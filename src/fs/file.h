@@ -7,13 +7,15 @@
 #include <fs/inode.h>
 #include <sys/stat.h>
 #include <common/list.h>
+#include <common/rc.h>
+#include <common/bitmap.h>
 
 #define NFILE 2048  // Open files per system
 #define NOFILE 128  // open files per process
 
 typedef struct file {
     enum { FD_NONE, FD_PIPE, FD_INODE } type;
-    int ref;
+    RefCount ref;
     char readable;
     char writable;
     struct pipe* pipe;
@@ -22,22 +24,45 @@ typedef struct file {
 } File;
 
 struct ftable {
-    // TODO: table of file objects in the system
-    SpinLock lock;
-    File file[NFILE];
+    // file objects are allocated by `kalloc`, only their number is kept here.
+    RefCount num_files;
 };
 
 struct oftable {
     // TODO: table of opened file descriptors in a process
     File* fp[NOFILE];
+    Bitmap(used, NOFILE);  // bit i is set iff fp[i] != NULL.
+    int next_fd;           // no free fd below it.
 };
 
 void init_ftable();
 void init_oftable(struct oftable*);
 
 /*
- * Iterate the file table to get a file structure with ref == 0.
- * Set the ref to 1.
+ * Install f at the lowest free fd of oftable.
+ * Return the fd, or -1 if the table is full.
+ */
+int alloc_fd(struct oftable* oftable, struct file* f);
+
+/*
+ * Remove fd from oftable and return its file, or NULL if fd is not open.
+ * The reference held by the table is passed to the caller.
+ */
+struct file* free_fd(struct oftable* oftable, int fd);
+
+/*
+ * Close every fd of oftable.
+ */
+void close_oftable(struct oftable* oftable);
+
+/*
+ * Make dst a copy of src, sharing its files.
+ */
+void dup_oftable(struct oftable* dst, struct oftable* src);
+
+/*
+ * Allocate a zeroed file structure with ref == 1.
+ * Return NULL if there are already NFILE files in the system.
  */
 struct file* filealloc();
 
@@ -70,3 +95,19 @@ isize fileread(struct file* f, char* addr, isize n);
  * There should be a maximum valid value of n.
  */
 isize filewrite(struct file* f, char* addr, isize n);
+
+/*
+ * Allocate blocks for the data `filewrite` has buffered in memory and write
+ * it out. Called on close and by fsync.
+ */
+void fileflush(struct file* f);
+
+/*
+ * Move up to n bytes of regular file `in`, beginning at *off, to `out`
+ * without going through user memory, and advance *off accordingly.
+ * The console takes the cached blocks of `in` directly. Pipes and regular
+ * files get a copy through a kernel page instead, as a pipe does not hold
+ * references to cached blocks.
+ * Return the number of bytes moved.
+ */
+isize filesend(struct file* out, struct file* in, usize* off, isize n);
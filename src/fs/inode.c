@@ -1,4 +1,6 @@
+#include <common/bitmap.h>
 #include <common/string.h>
+#include <fs/dcache.h>
 #include <fs/inode.h>
 #include <kernel/console.h>
 #include <kernel/mem.h>
@@ -7,14 +9,57 @@
 #include <kernel/sched.h>
 #include <kernel/console.h>
 
-// this lock mainly prevents concurrent access to inode list `head`, reference
-// count increment and decrement.
-static SpinLock lock;
-static ListNode head;
+// number of buckets in the in-memory inode hash table.
+#define INODE_HASH_SIZE 64
+
+// maximum number of unreferenced inodes kept warm in memory.
+#define INODE_LRU_MAX 64
+
+// in-memory inodes are hashed by inode number. The lock of a bucket protects
+// its list, and reference count increment and decrement of inodes in it.
+typedef struct {
+    SpinLock lock;
+    ListNode head;
+} InodeBucket;
+
+static InodeBucket buckets[INODE_HASH_SIZE];
+
+// inodes whose reference count dropped to zero, most recently used first.
+// they stay in their buckets so that `inode_get` can pick them up again.
+// lock order: bucket lock, then `lru_lock`.
+static SpinLock lru_lock;
+static ListNode lru;
+static usize lru_count;
+
+// free inode bitmap. It is rebuilt from inode blocks in `init_inodes`, and
+// there is no free inode below `next_free`.
+static SpinLock bitmap_lock;
+static BitmapCell* inode_bitmap;
+static usize next_free;
 
 static const SuperBlock* sblock;
 static const BlockCache* cache;
 
+static bool ordered_data;  // see `SB_ORDERED_DATA` and `set_ordered_data`.
+
+// appended data of a regular file that has no disk blocks yet. it covers
+// [start, entry.num_bytes), where `start` is the end of the allocated blocks.
+// the in-memory `entry.num_bytes` includes it, but the size written to disk
+// stops at `start` until `inode_flush` gives the data its blocks, so a crash
+// never exposes unallocated blocks. pages[i] holds block start/BLOCK_SIZE + i.
+struct DelayedData {
+    usize start;
+    u8* pages[INODE_MAX_DELAYED_BLOCKS];
+};
+
+// pages held by the delayed data of all inodes, see `INODE_MAX_DELAYED_PAGES`.
+static usize num_delayed_pages;
+
+static void free_dir_index(Inode* inode);
+static void free_delayed(Inode* inode);
+static void inode_flush(OpContext* ctx, Inode* inode);
+static usize inode_write(OpContext* ctx, Inode* inode, u8* src, usize offset, usize count);
+
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
     return sblock->inode_start + (inode_no / (INODE_PER_BLOCK));
@@ -25,17 +70,66 @@ static INLINE InodeEntry* get_entry(Block* block, usize inode_no) {
     return ((InodeEntry*)block->data) + (inode_no % INODE_PER_BLOCK);
 }
 
+// in ordered-data mode, the data blocks of regular files do not go through
+// the log. indirect blocks and directories always do.
+static INLINE bool is_ordered(Inode* inode) {
+    return ordered_data && inode->entry.type == INODE_REGULAR;
+}
+
+// allocate a block holding the content of `inode`.
+static INLINE u32 alloc_data_block(OpContext* ctx, Inode* inode) {
+    return is_ordered(inode) ? cache->alloc_data(ctx) : cache->alloc(ctx);
+}
+
 // return address array in indirect block.
 static INLINE u32* get_addrs(Block* block) {
     return ((IndirectBlock*)block->data)->addrs;
 }
 
+static INLINE InodeBucket* to_bucket(usize inode_no) {
+    return &buckets[inode_no % INODE_HASH_SIZE];
+}
+
+// scan all inode blocks and mark used inodes in `inode_bitmap`.
+static void build_inode_bitmap() {
+    usize size = BITMAP_TO_NUM_CELLS(sblock->num_inodes) * sizeof(BitmapCell);
+    inode_bitmap = kalloc(size);
+    memset(inode_bitmap, 0, size);
+    bitmap_set(inode_bitmap, 0);
+    for(usize i = 0; i < sblock->num_inodes; i += INODE_PER_BLOCK){
+        Block* b = cache->acquire(to_block_no(i));
+        for(usize j = i; j < i + INODE_PER_BLOCK && j < sblock->num_inodes; j++){
+            if(get_entry(b, j)->type != INODE_INVALID)
+                bitmap_set(inode_bitmap, j);
+        }
+        cache->release(b);
+    }
+    next_free = 1;
+}
+
+// mark `inode_no` as free in `inode_bitmap`.
+static void release_inode_no(usize inode_no) {
+    _acquire_spinlock(&bitmap_lock);
+    bitmap_clear(inode_bitmap, inode_no);
+    next_free = MIN(next_free, inode_no);
+    _release_spinlock(&bitmap_lock);
+}
+
 // initialize inode tree.
 void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
-    init_spinlock(&lock);
-    init_list_node(&head);
+    for(usize i = 0; i < INODE_HASH_SIZE; i++){
+        init_spinlock(&buckets[i].lock);
+        init_list_node(&buckets[i].head);
+    }
+    init_spinlock(&lru_lock);
+    init_list_node(&lru);
+    lru_count = 0;
+    init_spinlock(&bitmap_lock);
+    init_dcache();
     sblock = _sblock;
     cache = _cache;
+    ordered_data = sblock->flags & SB_ORDERED_DATA;
+    build_inode_bitmap();
 
     if (ROOT_INODE_NO < sblock->num_inodes)
         inodes.root = inodes.get(ROOT_INODE_NO);
@@ -48,7 +142,10 @@ static void init_inode(Inode* inode) {
     init_sleeplock(&inode->lock);
     init_rc(&inode->rc);
     init_list_node(&inode->node);
+    init_list_node(&inode->lru);
     inode->inode_no = 0;
+    inode->dir_index = NULL;
+    inode->delayed = NULL;
     inode->valid = false;
 }
 
@@ -57,20 +154,35 @@ static usize inode_alloc(OpContext* ctx, InodeType type) {
     ASSERT(type != INODE_INVALID);
 
     // TODO
-    for(u32 i = 1; i < sblock->num_inodes; i++){
-        Block* b = cache->acquire(to_block_no(i));
-        InodeEntry* entry = get_entry(b, i);
-        if(entry->type == INODE_INVALID){
-            memset(entry, 0, sizeof(InodeEntry));
-            entry->type = type;
-            cache->sync(ctx, b);
-            cache->release(b);
-            return i;
+    usize inode_no = 0;
+    _acquire_spinlock(&bitmap_lock);
+    for(usize i = next_free; i < sblock->num_inodes; i++){
+        // skip cells whose inodes are all in use.
+        if(i % BITMAP_BITS_PER_CELL == 0 &&
+           inode_bitmap[i / BITMAP_BITS_PER_CELL] == ~(BitmapCell)0){
+            i += BITMAP_BITS_PER_CELL - 1;
+            continue;
+        }
+        if(!bitmap_get(inode_bitmap, i)){
+            bitmap_set(inode_bitmap, i);
+            inode_no = i;
+            break;
         }
-        cache->release(b);
     }
-    PANIC();
-    return 0;
+    if(inode_no != 0)
+        next_free = inode_no + 1;
+    _release_spinlock(&bitmap_lock);
+    if(inode_no == 0)
+        PANIC();
+
+    Block* b = cache->acquire(to_block_no(inode_no));
+    InodeEntry* entry = get_entry(b, inode_no);
+    ASSERT(entry->type == INODE_INVALID);
+    memset(entry, 0, sizeof(InodeEntry));
+    entry->type = type;
+    cache->sync(ctx, b);
+    cache->release(b);
+    return inode_no;
 }
 
 // see `inode.h`.
@@ -94,6 +206,9 @@ static void inode_sync(OpContext* ctx, Inode* inode, bool do_write) {
     InodeEntry* entry = get_entry(b, inode->inode_no);
     if(inode->valid && do_write){
         memmove(entry, &inode->entry, sizeof(InodeEntry));
+        // the disk only knows the file up to its allocated blocks.
+        if(inode->delayed)
+            entry->num_bytes = inode->delayed->start;
         cache->sync(ctx, b);
     }else if(!inode->valid){
         memmove(&inode->entry, entry, sizeof(InodeEntry));
@@ -106,16 +221,23 @@ static void inode_sync(OpContext* ctx, Inode* inode, bool do_write) {
 static Inode* inode_get(usize inode_no) {
     ASSERT(inode_no > 0);
     ASSERT(inode_no < sblock->num_inodes);
-    _acquire_spinlock(&lock);
+    auto bucket = to_bucket(inode_no);
+    _acquire_spinlock(&bucket->lock);
     // TODO
     Inode* inode;
 
-    _for_in_list(p, &head){
-        if(p == &head) continue;
+    _for_in_list(p, &bucket->head){
+        if(p == &bucket->head) continue;
         inode = container_of(p, Inode, node);
         if(inode->inode_no == inode_no){
+            if(inode->rc.count == 0){
+                _acquire_spinlock(&lru_lock);
+                _detach_from_list(&inode->lru);
+                lru_count--;
+                _release_spinlock(&lru_lock);
+            }
             _increment_rc(&inode->rc);
-            _release_spinlock(&lock);
+            _release_spinlock(&bucket->lock);
             inode_lock(inode);
             inode_unlock(inode);
             return inode;
@@ -126,19 +248,39 @@ static Inode* inode_get(usize inode_no) {
     init_inode(inode);
     inode->inode_no = inode_no;
     _increment_rc(&inode->rc);
-    _insert_into_list(&head, &inode->node);
+    _insert_into_list(&bucket->head, &inode->node);
 
     inode_lock(inode);
-    _release_spinlock(&lock);
+    _release_spinlock(&bucket->lock);
     inode_sync(NULL, inode, false);
     inode_unlock(inode);
 
     ASSERT(inode->entry.type != INODE_INVALID);
     return inode;
 }
+
+// free an indirect block and all data blocks it points to.
+static void free_indirect(OpContext* ctx, u32 block_no) {
+    auto b = cache->acquire(block_no);
+    auto addrs = get_addrs(b);
+    for(usize i = 0; i < INODE_NUM_INDIRECT; i++){
+        if(addrs[i] != NULL){
+            cache->free(ctx, addrs[i]);
+        }
+    }
+    cache->release(b);
+    cache->free(ctx, block_no);
+}
+
 // see `inode.h`.
 static void inode_clear(OpContext* ctx, Inode* inode) {
     // TODO
+    // buffered data is dropped before it ever gets a block.
+    free_delayed(inode);
+    if (inode->entry.type == INODE_DIRECTORY) {
+        free_dir_index(inode);
+        dcache_purge(inode->inode_no);
+    }
     auto entry = &inode->entry;
     for(u32 i = 0; i < INODE_NUM_DIRECT; i++){
         if(entry->addrs[i] != NULL){
@@ -147,16 +289,20 @@ static void inode_clear(OpContext* ctx, Inode* inode) {
         }
     }
     if(entry->indirect != NULL){
-        auto b = cache->acquire(entry->indirect);
+        free_indirect(ctx, entry->indirect);
+        entry->indirect = NULL;
+    }
+    if(entry->double_indirect != NULL){
+        auto b = cache->acquire(entry->double_indirect);
         auto addrs = get_addrs(b);
         for(usize i = 0; i < INODE_NUM_INDIRECT; i++){
             if(addrs[i] != NULL){
-                cache->free(ctx, addrs[i]);
+                free_indirect(ctx, addrs[i]);
             }
         }
         cache->release(b);
-        cache->free(ctx, entry->indirect);
-        entry->indirect = NULL;
+        cache->free(ctx, entry->double_indirect);
+        entry->double_indirect = NULL;
     }
     entry->num_bytes = 0;
     inode_sync(ctx, inode, true);
@@ -165,30 +311,118 @@ static void inode_clear(OpContext* ctx, Inode* inode) {
 // see `inode.h`.
 static Inode* inode_share(Inode* inode) {
     // TODO
-    _acquire_spinlock(&lock);
+    auto bucket = to_bucket(inode->inode_no);
+    _acquire_spinlock(&bucket->lock);
     _increment_rc(&inode->rc);
-    _release_spinlock(&lock);
+    _release_spinlock(&bucket->lock);
     return inode;
 }
 
+// drop the least recently used inodes until at most `INODE_LRU_MAX` of them
+// are kept warm.
+static void shrink_lru() {
+    while(true){
+        _acquire_spinlock(&lru_lock);
+        if(lru_count <= INODE_LRU_MAX){
+            _release_spinlock(&lru_lock);
+            return;
+        }
+        Inode* victim = container_of(lru.prev, Inode, lru);
+        usize inode_no = victim->inode_no;
+        _release_spinlock(&lru_lock);
+
+        // `victim` may be taken by `inode_get` or freed by another caller
+        // before we hold its bucket lock. Check that it is still the tail.
+        auto bucket = to_bucket(inode_no);
+        _acquire_spinlock(&bucket->lock);
+        _acquire_spinlock(&lru_lock);
+        bool ok = lru.prev == &victim->lru && victim->inode_no == inode_no;
+        if(ok){
+            _detach_from_list(&victim->lru);
+            _detach_from_list(&victim->node);
+            lru_count--;
+        }
+        _release_spinlock(&lru_lock);
+        _release_spinlock(&bucket->lock);
+        if(ok){
+            free_dir_index(victim);
+            kfree(victim);
+        }
+    }
+}
+
 // see `inode.h`.
 static void inode_put(OpContext* ctx, Inode* inode) {
     // TODO
-    _acquire_spinlock(&lock);
+    // buffered data of a linked inode outlives the last reference on disk
+    // only. that of an unlinked one is dropped with it below.
+    if(inode->rc.count == 1){
+        inode_lock(inode);
+        if(inode->delayed != NULL && inode->entry.num_links > 0)
+            inode_flush(ctx, inode);
+        inode_unlock(inode);
+    }
+    usize inode_no = inode->inode_no;
+    auto bucket = to_bucket(inode_no);
+    _acquire_spinlock(&bucket->lock);
     if(inode->rc.count == 1 && inode->entry.num_links == 0 && inode->valid){
         _detach_from_list(&inode->node);
         inode_lock(inode);
-        _release_spinlock(&lock);
+        _release_spinlock(&bucket->lock);
         inode_clear(ctx, inode);
         inode->entry.type = INODE_INVALID;
         inode_sync(ctx, inode, true);
         inode->valid = false;
         inode_unlock(inode);
+        free_dir_index(inode);
         kfree(inode);
+        release_inode_no(inode_no);
         return;
     }
-    _decrement_rc(&inode->rc);
-    _release_spinlock(&lock);
+    bool cold = _decrement_rc(&inode->rc);
+    if(cold){
+        _acquire_spinlock(&lru_lock);
+        _insert_into_list(&lru, &inode->lru);
+        lru_count++;
+        _release_spinlock(&lru_lock);
+    }
+    _release_spinlock(&bucket->lock);
+    if(cold)
+        shrink_lru();
+}
+
+// return the number of consecutive entries in `addrs`, starting from the
+// first one, that are allocated and also adjacent on disk. At most `max`.
+static INLINE usize count_run(const u32* addrs, usize max) {
+    usize n = 1;
+    while(n < max && addrs[n] != NULL && addrs[n] == addrs[0] + n)
+        n++;
+    return n;
+}
+
+// look up `index` in the indirect block `block_no`, allocating the entry if
+// it is empty. `*run` is updated as described in `inode_map`.
+// entries of the indirect block are data blocks of `inode` if `data` is set.
+static u32 map_indirect(OpContext* ctx,
+                        Inode* inode,
+                        bool data,
+                        u32 block_no,
+                        usize index,
+                        bool* modified,
+                        usize* run) {
+    auto b = cache->acquire(block_no);
+    auto addrs = get_addrs(b);
+    if(addrs[index] == NULL){
+        addrs[index] = data ? alloc_data_block(ctx, inode) : cache->alloc(ctx);
+        cache->sync(ctx, b);
+        *modified = true;
+        *run = 1;
+    }else{
+        *run = count_run(addrs + index, MIN(*run, INODE_NUM_INDIRECT - index));
+    }
+    u32 result = addrs[index];
+    cache->release(b);
+    return result;
 }
 
 // this function is private to inode layer, because it can allocate block
@@ -199,48 +433,67 @@ static void inode_put(OpContext* ctx, Inode* inode) {
 // which time, `*modified` will be set to true.
 // the block number is returned.
 //
+// if `run` is not NULL, on entry `*run` is the number of blocks the caller
+// is going to access starting from `offset`. On return it is set to how many
+// of them (at least 1) are already allocated and contiguous on disk, so that
+// the caller can access the whole run without mapping each block again.
+//
 // NOTE: caller must hold the lock of `inode`.
 static usize inode_map(OpContext* ctx,
                        Inode* inode,
                        usize offset,
-                       bool* modified) {
+                       bool* modified,
+                       usize* run) {
     // TODO
     u32 block_no;
+    usize max_run = run != NULL ? MAX(*run, (usize)1) : 1;
     auto entry = &inode->entry;
     *modified = false;
     if(offset < INODE_NUM_DIRECT){
         if(entry->addrs[offset] == NULL){
-            entry->addrs[offset] = cache->alloc(ctx);
+            entry->addrs[offset] = alloc_data_block(ctx, inode);
             *modified = true;
+            max_run = 1;
+        }else{
+            max_run = count_run(entry->addrs + offset,
+                                MIN(max_run, INODE_NUM_DIRECT - offset));
         }
         block_no = entry->addrs[offset];
     }else if(offset < INODE_NUM_DIRECT + INODE_NUM_INDIRECT){
         offset -= INODE_NUM_DIRECT;
         if(entry->indirect == NULL){
             entry->indirect = cache->alloc(ctx);
+            *modified = true;
         }
-        auto b = cache->acquire(entry->indirect);
-        auto addrs = get_addrs(b);
-        if(addrs[offset] == NULL){
-            addrs[offset] = cache->alloc(ctx);
-            cache->sync(ctx, b);
+        block_no = map_indirect(ctx, inode, true, entry->indirect, offset,
+                                modified, &max_run);
+    }else if(offset < INODE_MAX_BLOCKS){
+        offset -= INODE_NUM_DIRECT + INODE_NUM_INDIRECT;
+        if(entry->double_indirect == NULL){
+            entry->double_indirect = cache->alloc(ctx);
             *modified = true;
         }
-        block_no = addrs[offset];
-        cache->release(b);
+        usize one = 1;
+        u32 indirect = map_indirect(ctx, inode, false, entry->double_indirect,
+                                    offset / INODE_NUM_INDIRECT, modified, &one);
+        block_no = map_indirect(ctx, inode, true, indirect,
+                                offset % INODE_NUM_INDIRECT, modified, &max_run);
     }else{
         PANIC();
     }
+    if(run != NULL)
+        *run = max_run;
     return block_no;
 }
 
 // see `inode.h`.
-static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
+static usize inode_read_to(Inode* inode,
+                           usize offset,
+                           usize count,
+                           InodeSink sink,
+                           void* arg) {
     InodeEntry* entry = &inode->entry;
-    if (inode->entry.type == INODE_DEVICE) {
-        ASSERT(inode->entry.major == 1);
-        return console_read(inode, (char*)dest, count);
-    }
+    ASSERT(entry->type != INODE_DEVICE);
     if (count + offset > entry->num_bytes)
         count = entry->num_bytes - offset;
     usize end = offset + count;
@@ -248,22 +501,151 @@ static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
     ASSERT(end <= entry->num_bytes);
     ASSERT(offset <= end);
 
-    // TODO
     if(count == 0) return count;
     count = 0;
-    for(usize i = offset/BLOCK_SIZE; i <= (end-1)/BLOCK_SIZE; i++){
-        usize n = MIN(end - offset, (i + 1) * BLOCK_SIZE - offset);
+    usize last = (end-1)/BLOCK_SIZE;
+    // blocks from `first_delayed` on only live in the delayed buffer.
+    usize first_delayed = inode->delayed ? inode->delayed->start / BLOCK_SIZE : last + 1;
+    for(usize i = offset/BLOCK_SIZE; i <= last;){
+        if(i >= first_delayed){
+            usize n = MIN(end - offset, (i + 1) * BLOCK_SIZE - offset);
+            u8* page = inode->delayed->pages[i - first_delayed];
+            usize t = sink(arg, page + offset % BLOCK_SIZE, n);
+            offset += t;
+            count += t;
+            if(t != n) return count;
+            i++;
+            continue;
+        }
         bool modified;
-        auto block_no = inode_map(NULL, inode, i, &modified);
-        auto b = cache->acquire(block_no);
-        memmove(dest + count, b->data + offset % BLOCK_SIZE, n);
-        cache->release(b);
-        offset += n;
-        count += n;
+        usize run = MIN(last + 1, first_delayed) - i;
+        usize block_no = inode_map(NULL, inode, i, &modified, &run);
+        for(usize k = 0; k < run; k++, i++){
+            usize n = MIN(end - offset, (i + 1) * BLOCK_SIZE - offset);
+            auto b = cache->acquire(block_no + k);
+            usize t = sink(arg, b->data + offset % BLOCK_SIZE, n);
+            cache->release(b);
+            offset += t;
+            count += t;
+            if(t != n) return count;
+        }
     }
     return count;
 }
 
+static usize copy_sink(void* arg, u8* data, usize n) {
+    u8** dest = arg;
+    memmove(*dest, data, n);
+    *dest += n;
+    return n;
+}
+
+// see `inode.h`.
+static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
+    if (inode->entry.type == INODE_DEVICE) {
+        ASSERT(inode->entry.major == 1);
+        return console_read(inode, (char*)dest, count);
+    }
+    // TODO
+    return inode_read_to(inode, offset, count, copy_sink, &dest);
+}
+
+// drop the delayed data of `inode` without writing it.
+static void free_delayed(Inode* inode) {
+    auto d = inode->delayed;
+    if(d == NULL)
+        return;
+    usize i;
+    for(i = 0; i < INODE_MAX_DELAYED_BLOCKS && d->pages[i] != NULL; i++)
+        kfree_page(d->pages[i]);
+    __atomic_sub_fetch(&num_delayed_pages, i, __ATOMIC_RELAXED);
+    kfree(d);
+    inode->delayed = NULL;
+}
+
+// a zeroed page for delayed data, or NULL if all inodes together hold
+// `INODE_MAX_DELAYED_PAGES` already or memory is short.
+static u8* alloc_delayed_page() {
+    if(__atomic_add_fetch(&num_delayed_pages, 1, __ATOMIC_RELAXED) > INODE_MAX_DELAYED_PAGES){
+        __atomic_sub_fetch(&num_delayed_pages, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    u8* page = kalloc_page();
+    if(page == NULL){
+        __atomic_sub_fetch(&num_delayed_pages, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    memset(page, 0, BLOCK_SIZE);
+    return page;
+}
+
+// see `inode.h`.
+static usize inode_write_delayed(Inode* inode,
+                                 u8* src,
+                                 usize offset,
+                                 usize count,
+                                 usize* alloc_end) {
+    InodeEntry* entry = &inode->entry;
+    ASSERT(entry->type == INODE_REGULAR);
+    ASSERT(offset <= entry->num_bytes);
+    auto d = inode->delayed;
+    usize start = d ? d->start : round_up(entry->num_bytes, BLOCK_SIZE);
+    *alloc_end = start;
+    if(offset < start)
+        return 0;
+    usize end = MIN(offset + count, start + INODE_MAX_DELAYED_BLOCKS * BLOCK_SIZE);
+    end = MIN(end, (usize)INODE_MAX_BYTES);
+    if(end <= offset)
+        return 0;
+    if(d == NULL){
+        d = kalloc(sizeof(DelayedData));
+        memset(d, 0, sizeof(DelayedData));
+        d->start = start;
+        inode->delayed = d;
+    }
+    // pages are filled in order: `offset` is at most the buffered end.
+    usize pos = offset;
+    while(pos < end){
+        usize i = (pos - start) / BLOCK_SIZE;
+        if(d->pages[i] == NULL && (d->pages[i] = alloc_delayed_page()) == NULL)
+            break;
+        usize n = MIN(end - pos, BLOCK_SIZE - pos % BLOCK_SIZE);
+        memmove(d->pages[i] + pos % BLOCK_SIZE, src + (pos - offset), n);
+        pos += n;
+    }
+    if(d->pages[0] == NULL)
+        free_delayed(inode);
+    entry->num_bytes = MAX(entry->num_bytes, pos);
+    return pos - offset;
+}
+
+// see `inode.h`.
+static void inode_flush(OpContext* ctx, Inode* inode) {
+    auto d = inode->delayed;
+    if(d == NULL)
+        return;
+    usize end = inode->entry.num_bytes;
+    inode->delayed = NULL;
+    inode->entry.num_bytes = d->start;
+    // all blocks are mapped in one go so that they are allocated back to
+    // back, then the pages are written over them.
+    usize last = (end - 1) / BLOCK_SIZE;
+    for(usize i = d->start / BLOCK_SIZE; i <= last;){
+        bool modified;
+        usize run = last - i + 1;
+        inode_map(ctx, inode, i, &modified, &run);
+        i += run;
+    }
+    for(usize i = 0; d->start + i * BLOCK_SIZE < end; i++){
+        usize offset = d->start + i * BLOCK_SIZE;
+        inode_write(ctx, inode, d->pages[i], offset, MIN((usize)BLOCK_SIZE, end - offset));
+    }
+    inode->delayed = d;
+    free_delayed(inode);
+    // the blocks mapped above may not all be reported dirty by `inode_write`.
+    inode_sync(ctx, inode, true);
+}
+
 // see `inode.h`.
 static usize inode_write(OpContext* ctx,
                          Inode* inode,
@@ -276,46 +658,279 @@ static usize inode_write(OpContext* ctx,
         ASSERT(inode->entry.major == 1);
         return console_write(inode, (char*)src, count);
     }
+    // the directory may change behind the index and the dentry cache.
+    if (inode->entry.type == INODE_DIRECTORY) {
+        free_dir_index(inode);
+        dcache_purge(inode->inode_no);
+    }
     ASSERT(offset <= entry->num_bytes);
     ASSERT(end <= INODE_MAX_BYTES);
     ASSERT(offset <= end);
+    if (inode->delayed && end > inode->delayed->start)
+        inode_flush(ctx, inode);
 
     // TODO
     count = 0;
-    for(usize i = offset/BLOCK_SIZE; i <= (end-1)/BLOCK_SIZE; i++){
-        usize n = MIN(end - offset, (i + 1) * BLOCK_SIZE - offset);
+    if(offset == end) return count;
+    bool dirty = false;
+    bool ordered = is_ordered(inode);
+    usize first_new = (entry->num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    usize last = (end-1)/BLOCK_SIZE;
+    // allocate the whole range before copying, so that the new blocks are
+    // taken from the bitmap together and the copy runs over long extents.
+    for(usize i = MAX(offset/BLOCK_SIZE, first_new); i <= last;){
         bool modified;
-        auto block_no = inode_map(ctx, inode, i, &modified);
-        auto b = cache->acquire(block_no);
-        memmove(b->data + offset % BLOCK_SIZE, src + count, n);
-        cache->sync(ctx, b);
-        cache->release(b);
-        offset += n;
-        count += n;
+        usize run = last - i + 1;
+        inode_map(ctx, inode, i, &modified, &run);
+        dirty |= modified;
+        i += run;
+    }
+    for(usize i = offset/BLOCK_SIZE; i <= last;){
+        bool modified;
+        usize run = last - i + 1;
+        usize block_no = inode_map(ctx, inode, i, &modified, &run);
+        for(usize k = 0; k < run; k++, i++){
+            usize n = MIN(end - offset, (i + 1) * BLOCK_SIZE - offset);
+            auto b = cache->acquire(block_no + k);
+            // new blocks from `alloc_data` may hold stale data around the
+            // part written here.
+            if(ordered && i >= first_new)
+                memset(b->data, 0, BLOCK_SIZE);
+            memmove(b->data + offset % BLOCK_SIZE, src + count, n);
+            if(ordered){
+                // written in place before the metadata that points to it
+                // commits, so only the metadata goes through the log.
+                cache->sync_data(ctx, b);
+            }else{
+                cache->sync(ctx, b);
+            }
+            cache->release(b);
+            offset += n;
+            count += n;
+        }
     }
     if(end > entry->num_bytes){
         entry->num_bytes = end;
-        inode_sync(ctx, inode, true);
+        dirty = true;
     }
+    if(dirty)
+        inode_sync(ctx, inode, true);
     return count;
 }
 
+// directory entries never cross block boundaries.
+#define DIRENT_PER_BLOCK (BLOCK_SIZE / sizeof(DirEntry))
+
+// read the directory entry at `offset` of `inode`.
+static void read_dirent(Inode* inode, usize offset, DirEntry* de) {
+    bool modified;
+    usize block_no = inode_map(NULL, inode, offset / BLOCK_SIZE, &modified, NULL);
+    Block* b = cache->acquire(block_no);
+    memmove(de, b->data + offset % BLOCK_SIZE, sizeof(DirEntry));
+    cache->release(b);
+}
+
+// write the directory entry at `offset` of `inode`, which may append a new
+// entry right after the last one.
+static void write_dirent(OpContext* ctx, Inode* inode, usize offset, DirEntry* de) {
+    bool modified;
+    usize block_no = inode_map(ctx, inode, offset / BLOCK_SIZE, &modified, NULL);
+    Block* b = cache->acquire(block_no);
+    memmove(b->data + offset % BLOCK_SIZE, de, sizeof(DirEntry));
+    cache->sync(ctx, b);
+    cache->release(b);
+    if(offset + sizeof(DirEntry) > inode->entry.num_bytes){
+        inode->entry.num_bytes = offset + sizeof(DirEntry);
+        modified = true;
+    }
+    if(modified)
+        inode_sync(ctx, inode, true);
+}
+
+// visit directory entries of `inode` block by block, starting from entry
+// `slot`. Return the slot of the first entry for which `visit` returns true,
+// or the number of entries if there is none.
+static usize dir_scan(Inode* inode,
+                      usize slot,
+                      bool (*visit)(DirEntry* de, usize slot, void* arg),
+                      void* arg) {
+    usize num_slots = inode->entry.num_bytes / sizeof(DirEntry);
+    while(slot < num_slots){
+        bool modified;
+        usize i = slot / DIRENT_PER_BLOCK;
+        usize run = (num_slots - 1) / DIRENT_PER_BLOCK - i + 1;
+        usize block_no = inode_map(NULL, inode, i, &modified, &run);
+        for(usize k = 0; k < run; k++){
+            Block* b = cache->acquire(block_no + k);
+            DirEntry* de = (DirEntry*)b->data;
+            usize end = MIN(num_slots, (i + k + 1) * DIRENT_PER_BLOCK);
+            for(; slot < end; slot++){
+                if(visit(&de[slot % DIRENT_PER_BLOCK], slot, arg)){
+                    cache->release(b);
+                    return slot;
+                }
+            }
+            cache->release(b);
+        }
+    }
+    return num_slots;
+}
+
+// directories larger than this are indexed in memory when first looked up.
+// smaller ones, and those too large for the index or for the pages left
+// to build it, are scanned instead.
+#define DIR_INDEX_MIN_BYTES      BLOCK_SIZE
+#define DIR_INDEX_NUM_BUCKETS    (PAGE_SIZE / sizeof(u32))
+#define DIR_INDEX_SLOTS_PER_PAGE (PAGE_SIZE / sizeof(DirIndexSlot))
+#define DIR_INDEX_MAX_PAGES      256
+
+// the on-disk directory stays a linear array of `DirEntry`, and entry `i`
+// is slot `i` of the index. Used slots whose names fall into the same
+// bucket are chained through `next`.
+typedef struct {
+    u32 next;  // next slot plus one, or 0 at the end of the chain.
+    u32 hash;  // hash of the name in this slot.
+} DirIndexSlot;
+
+struct DirIndex {
+    u32* buckets;      // first slot plus one of each chain, or 0.
+    usize num_free;    // number of free slots in the directory.
+    usize free_hint;   // there is no free slot below this one.
+    DirIndexSlot* pages[DIR_INDEX_MAX_PAGES];
+};
+
+static INLINE DirIndexSlot* index_slot(DirIndex* index, usize slot) {
+    return &index->pages[slot / DIR_INDEX_SLOTS_PER_PAGE][slot % DIR_INDEX_SLOTS_PER_PAGE];
+}
+
+// drop the directory index of `inode`, if any.
+static void free_dir_index(Inode* inode) {
+    auto index = inode->dir_index;
+    if(index == NULL)
+        return;
+    for(usize i = 0; i < DIR_INDEX_MAX_PAGES; i++){
+        if(index->pages[i] != NULL)
+            kfree_page(index->pages[i]);
+    }
+    kfree_page(index->buckets);
+    kfree(index);
+    inode->dir_index = NULL;
+}
+
+// add used `slot` to the index. Return false if the index is full or
+// there is no page for it; the caller then drops the index, and the
+// directory is scanned instead.
+static bool index_add(DirIndex* index, usize slot, u32 hash) {
+    usize page = slot / DIR_INDEX_SLOTS_PER_PAGE;
+    if(page >= DIR_INDEX_MAX_PAGES)
+        return false;
+    if(index->pages[page] == NULL && (index->pages[page] = kalloc_page()) == NULL)
+        return false;
+    auto s = index_slot(index, slot);
+    u32* head = &index->buckets[hash % DIR_INDEX_NUM_BUCKETS];
+    s->hash = hash;
+    s->next = *head;
+    *head = slot + 1;
+    return true;
+}
+
+// remove used `slot` from the index.
+static void index_del(DirIndex* index, usize slot, u32 hash) {
+    u32* p = &index->buckets[hash % DIR_INDEX_NUM_BUCKETS];
+    while(*p != slot + 1){
+        ASSERT(*p != 0);
+        p = &index_slot(index, *p - 1)->next;
+    }
+    *p = index_slot(index, slot)->next;
+}
+
+static bool visit_build(DirEntry* de, usize slot, void* arg) {
+    DirIndex* index = arg;
+    if(de->inode_no == 0){
+        index->num_free++;
+        index->free_hint = MIN(index->free_hint, slot);
+        return false;
+    }
+    // stop scanning if the index is full or runs out of pages.
+    return !index_add(index, slot, name_hash(de->name));
+}
+
+// return the index of directory `inode`, building it if the directory is
+// large enough. Return NULL if the directory should be scanned instead.
+static DirIndex* get_dir_index(Inode* inode) {
+    if(inode->dir_index != NULL || inode->entry.num_bytes <= DIR_INDEX_MIN_BYTES)
+        return inode->dir_index;
+
+    usize num_slots = inode->entry.num_bytes / sizeof(DirEntry);
+    DirIndex* index = kalloc(sizeof(DirIndex));
+    memset(index, 0, sizeof(DirIndex));
+    index->buckets = kalloc_page();
+    if(index->buckets == NULL){
+        kfree(index);
+        return NULL;
+    }
+    memset(index->buckets, 0, PAGE_SIZE);
+    index->free_hint = num_slots;
+    inode->dir_index = index;
+    if(dir_scan(inode, 0, visit_build, index) != num_slots)
+        free_dir_index(inode);
+    return inode->dir_index;
+}
+
+typedef struct {
+    const char* name;
+    usize inode_no;
+} DirMatch;
+
+static bool visit_match(DirEntry* de, usize slot, void* arg) {
+    (void)slot;
+    DirMatch* match = arg;
+    if(de->inode_no != 0 && strncmp(match->name, de->name, FILE_NAME_MAX_LENGTH) == 0){
+        match->inode_no = de->inode_no;
+        return true;
+    }
+    return false;
+}
+
+static bool visit_free(DirEntry* de, usize slot, void* arg) {
+    (void)slot;
+    (void)arg;
+    return de->inode_no == 0;
+}
+
 // see `inode.h`.
 static usize inode_lookup(Inode* inode, const char* name, usize* index) {
     InodeEntry* entry = &inode->entry;
     ASSERT(entry->type == INODE_DIRECTORY);
 
     // TODO
-    for(usize offset = 0; offset < entry->num_bytes; offset += sizeof(DirEntry)){
-        DirEntry de;
-        inode_read(inode, (u8*)&de, offset, sizeof(DirEntry));
-        if(de.inode_no != 0 && strncmp(name, de.name, FILE_NAME_MAX_LENGTH) == 0){
-            if(index != NULL) *index = offset;
-            return de.inode_no;
+    auto dir_index = get_dir_index(inode);
+    if(dir_index != NULL){
+        u32 hash = name_hash(name);
+        u32 s = dir_index->buckets[hash % DIR_INDEX_NUM_BUCKETS];
+        while(s != 0){
+            auto slot = index_slot(dir_index, s - 1);
+            if(slot->hash == hash){
+                DirEntry de;
+                read_dirent(inode, (s - 1) * sizeof(DirEntry), &de);
+                if(de.inode_no != 0 && strncmp(name, de.name, FILE_NAME_MAX_LENGTH) == 0){
+                    if(index != NULL) *index = (s - 1) * sizeof(DirEntry);
+                    dcache_update(inode->inode_no, name, de.inode_no);
+                    return de.inode_no;
+                }
+            }
+            s = slot->next;
         }
+        dcache_update(inode->inode_no, name, 0);
+        return 0;
     }
 
-    return 0;
+    DirMatch match = {name, 0};
+    usize slot = dir_scan(inode, 0, visit_match, &match);
+    if(match.inode_no != 0 && index != NULL)
+        *index = slot * sizeof(DirEntry);
+    dcache_update(inode->inode_no, name, match.inode_no);
+    return match.inode_no;
 }
 
 // see `inode.h`.
@@ -327,24 +942,34 @@ static usize inode_insert(OpContext* ctx,
     ASSERT(entry->type == INODE_DIRECTORY);
 
     // TODO
-    usize index;
-    if(inode_lookup(inode, name, &index) != 0){
+    if(inode_lookup(inode, name, NULL) != 0){
         return -1;
     }
 
-    DirEntry de;
-    u32 offset = 0;
-    for(offset = 0; offset < entry->num_bytes; offset += sizeof(DirEntry)){
-        inode_read(inode, (u8*)&de, offset, sizeof(DirEntry));
-        if(de.inode_no == 0){
-            break;
-        }
-    }
+    // `inode_lookup` has built the index if the directory needs one.
+    auto dir_index = inode->dir_index;
+    usize num_slots = entry->num_bytes / sizeof(DirEntry);
+    usize slot;
+    if(dir_index != NULL && dir_index->num_free == 0)
+        slot = num_slots;
+    else
+        slot = dir_scan(inode, dir_index != NULL ? dir_index->free_hint : 0, visit_free, NULL);
 
+    DirEntry de;
+    memset(&de, 0, sizeof(de));
     de.inode_no = inode_no;
-    memmove(de.name, name, FILE_NAME_MAX_LENGTH);
-    inode_write(ctx, inode, (u8*)&de, offset, sizeof(DirEntry));
-    return offset;
+    strncpy(de.name, name, FILE_NAME_MAX_LENGTH);
+    write_dirent(ctx, inode, slot * sizeof(DirEntry), &de);
+    dcache_update(inode->inode_no, de.name, inode_no);
+
+    if(dir_index != NULL){
+        if(slot < num_slots)
+            dir_index->num_free--;
+        dir_index->free_hint = slot + 1;
+        if(!index_add(dir_index, slot, name_hash(de.name)))
+            free_dir_index(inode);
+    }
+    return slot * sizeof(DirEntry);
 }
 
 // see `inode.h`.
@@ -352,8 +977,20 @@ static void inode_remove(OpContext* ctx, Inode* inode, usize index) {
     // TODO
     ASSERT(index%sizeof(DirEntry) == 0);
     if(index < inode->entry.num_bytes){
-        DirEntry de = {0};
-        inode_write(ctx, inode, (u8*)&de, index, sizeof(DirEntry));
+        DirEntry de;
+        read_dirent(inode, index, &de);
+        if(de.inode_no == 0)
+            return;
+        auto dir_index = inode->dir_index;
+        if(dir_index != NULL){
+            usize slot = index / sizeof(DirEntry);
+            index_del(dir_index, slot, name_hash(de.name));
+            dir_index->num_free++;
+            dir_index->free_hint = MIN(dir_index->free_hint, slot);
+        }
+        dcache_update(inode->inode_no, de.name, 0);
+        memset(&de, 0, sizeof(de));
+        write_dirent(ctx, inode, index, &de);
     }
 }
 
@@ -367,6 +1004,9 @@ InodeTree inodes = {
     .share = inode_share,
     .put = inode_put,
     .read = inode_read,
+    .read_to = inode_read_to,
+    .write_delayed = inode_write_delayed,
+    .flush = inode_flush,
     .write = inode_write,
     .lookup = inode_lookup,
     .insert = inode_insert,
@@ -414,9 +1054,11 @@ static const char* skipelem(const char* path, char* name) {
  *
  * If parent != 0, return the inode for the parent and copy the final
  * path element into name, which must have room for DIRSIZ bytes.
+ * A relative path starts from base, or from the cwd if base is NULL.
  * Must be called inside a transaction since it calls iput().
  */
-static Inode* namex(const char* path,
+static Inode* namex(Inode* base,
+                    const char* path,
                     int nameiparent,
                     char* name,
                     OpContext* ctx) {
@@ -424,6 +1066,8 @@ static Inode* namex(const char* path,
     Inode* inode;
     if(*path == '/'){
         inode = inode_share(inodes.root);
+    }else if(base){
+        inode = inode_share(base);
     }else{
         inode = inode_share(thisproc()->cwd);
     }
@@ -432,20 +1076,26 @@ static Inode* namex(const char* path,
         return NULL;
 
     while((path = skipelem(path, name)) != 0){
-        inode_lock(inode);
-        if(inode->entry.type != INODE_DIRECTORY){
-            inode_unlock(inode);
-            inode_put(ctx, inode);
-            return NULL;
-        }
-        if(nameiparent && *path == '\0'){
+        usize inode_no;
+        bool last = nameiparent && *path == '\0';
+        // fast path: only directories have entries in the dentry cache, and
+        // a hit needs neither the lock nor the content of `inode`.
+        if(last || !dcache_lookup(inode->inode_no, name, &inode_no)){
+            inode_lock(inode);
+            if(inode->entry.type != INODE_DIRECTORY){
+                inode_unlock(inode);
+                inode_put(ctx, inode);
+                return NULL;
+            }
+            if(last){
+                inode_unlock(inode);
+                break;
+            }
+            inode_no = inode_lookup(inode, name, NULL);
             inode_unlock(inode);
-            break;
         }
-        usize inode_no = inode_lookup(inode, name, NULL);
-        inode_unlock(inode);
-        if(inode_no == 0) return NULL;
         inode_put(ctx, inode);
+        if(inode_no == 0) return NULL;
         inode = inode_get(inode_no);
     }
 
@@ -454,11 +1104,20 @@ static Inode* namex(const char* path,
 
 Inode* namei(const char* path, OpContext* ctx) {
     char name[FILE_NAME_MAX_LENGTH];
-    return namex(path, 0, name, ctx);
+    return namex(NULL, path, 0, name, ctx);
 }
 
 Inode* nameiparent(const char* path, char* name, OpContext* ctx) {
-    return namex(path, 1, name, ctx);
+    return namex(NULL, path, 1, name, ctx);
+}
+
+void set_ordered_data(bool enable) {
+    ordered_data = enable;
+}
+
+Inode* nameiat(Inode* base, const char* path, OpContext* ctx) {
+    char name[FILE_NAME_MAX_LENGTH];
+    return namex(base, path, 0, name, ctx);
 }
 
 /*
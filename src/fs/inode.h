@@ -9,7 +9,16 @@
 
 #define ROOT_INODE_NO 1
 
+// number of appended blocks an inode can buffer in memory before `flush`.
+#define INODE_MAX_DELAYED_BLOCKS 64
+
+// number of pages all inodes together can buffer that way. past it, writers
+// flush their buffers instead of growing them.
+#define INODE_MAX_DELAYED_PAGES 512
+
 struct InodeTree;
+typedef struct DirIndex DirIndex;
+typedef struct DelayedData DelayedData;
 
 typedef struct {
     // lock protects:
@@ -18,13 +27,21 @@ typedef struct {
     SleepLock lock;
 
     RefCount rc;
-    ListNode node;
+    ListNode node;  // in the hash bucket of `inode_no`.
+    ListNode lru;   // in the LRU list while `rc` is zero.
     usize inode_no;
 
     bool valid;        // is `entry` loaded?
     InodeEntry entry;  // real inode data on the disk.
+
+    struct DirIndex* dir_index;  // in-memory name index of directory, see `inode.c`.
+    struct DelayedData* delayed;  // appended data without disk blocks, see `inode.c`.
 } Inode;
 
+// consumer of `read_to`: takes up to `n` bytes at `data`, returns how many.
+// it runs with the inode locked and a block acquired, so it must not sleep.
+typedef usize (*InodeSink)(void* arg, u8* data, usize n);
+
 typedef struct InodeTree {
     Inode* root;
 
@@ -71,6 +88,9 @@ typedef struct InodeTree {
     // and on disk.
     //
     // NOTE: caller must NOT hold the lock of `inode`.
+    // NOTE: if data buffered by `write_delayed` is left when the last
+    // reference to a linked inode is dropped, `put` flushes it, and `ctx`
+    // must have room for that as for `flush`.
     void (*put)(OpContext* ctx, Inode* inode);
 
     // read `count` bytes from `inode`, beginning at `offset`, to `dest`.
@@ -78,8 +98,40 @@ typedef struct InodeTree {
     // NOTE: caller must hold the lock of `inode`.
     usize (*read)(Inode* inode, u8* dest, usize offset, usize count);
 
+    // like `read`, but hand the cached data of each block to `sink` instead
+    // of copying it to a buffer. stop early if `sink` takes fewer bytes than
+    // offered. return the number of bytes taken.
+    // NOTE: caller must hold the lock of `inode`, which must not be a device.
+    usize (*read_to)(Inode* inode,
+                     usize offset,
+                     usize count,
+                     InodeSink sink,
+                     void* arg);
+
+    // delayed allocation: buffer data for `inode` in memory instead of
+    // allocating blocks for it. only data past the allocated blocks of the
+    // file is taken, and `*alloc_end` is set to where they end, so that the
+    // caller can `write` the part before it. fewer than `count` bytes are
+    // taken when the buffer is full, until `flush` empties it, or when no
+    // page is left for it, see `INODE_MAX_DELAYED_PAGES`.
+    // return the number of bytes taken.
+    // NOTE: caller must hold the lock of `inode`, which must be a regular file.
+    usize (*write_delayed)(Inode* inode,
+                           u8* src,
+                           usize offset,
+                           usize count,
+                           usize* alloc_end);
+
+    // allocate blocks for the data buffered by `write_delayed` in one run,
+    // and write it out. `ctx` must have room for `INODE_MAX_DELAYED_BLOCKS`
+    // data blocks and their metadata.
+    // NOTE: caller must hold the lock of `inode`.
+    void (*flush)(OpContext* ctx, Inode* inode);
+
     // write exactly `count` bytes from `src` to `inode`, beginning at `offset`.
     // return the size you write
+    // if the range reaches data buffered by `write_delayed`, it is flushed
+    // first, and `ctx` must have room for that as well.
     // NOTE: caller must hold the lock of `inode`.
     usize (*write)(OpContext* ctx,
                    Inode* inode,
@@ -127,4 +179,10 @@ extern InodeTree inodes;
 void init_inodes(const SuperBlock* sblock, const BlockCache* cache);
 Inode* namei(const char* path, OpContext* ctx);
 Inode* nameiparent(const char* path, char* name, OpContext* ctx);
+// like `namei`, but a relative `path` is resolved from directory `base`.
+Inode* nameiat(Inode* base, const char* path, OpContext* ctx);
 void stati(Inode* ip, struct stat* st);
+// in ordered-data mode, `write` puts the data of regular files straight on
+// disk before the atomic operation commits, and only metadata is logged.
+// `init_inodes` takes it from `SB_ORDERED_DATA`; this overrides it.
+void set_ordered_data(bool enable);
@@ -2,14 +2,21 @@
 #include <kernel/sched.h>
 #include <fs/pipe.h>
 #include <common/string.h>
+#include <errno.h>
 
 int pipeAlloc(File** f0, File** f1) {
     // TODO
+    char* data = kalloc_page();
+    if(data == NULL) return -ENOMEM;
     (*f0) = filealloc();
-    if(*f0 == NULL) return -1;
+    if(*f0 == NULL){
+        kfree_page(data);
+        return -1;
+    }
     (*f1) = filealloc();
     if(*f1 == NULL){
         fileclose(*f0);
+        kfree_page(data);
         return -1;
     }
 
@@ -17,6 +24,8 @@ int pipeAlloc(File** f0, File** f1) {
     init_spinlock(&pi->lock);
     init_sem(&pi->wlock, 0);
     init_sem(&pi->rlock, 0);
+    pi->data[0] = data;
+    pi->size = PIPESIZE;
     pi->nread = pi->nwrite = 0;
     pi->readopen = pi->writeopen = 1;
     
@@ -28,6 +37,12 @@ int pipeAlloc(File** f0, File** f1) {
     return 0;
 }
 
+static void free_pipe(Pipe* pi) {
+    for(u32 i = 0; i < pi->size / PAGE_SIZE; i++)
+        kfree_page(pi->data[i]);
+    kfree(pi);
+}
+
 void pipeClose(Pipe* pi, int writable) {
     // TODO
     _acquire_spinlock(&pi->lock);
@@ -40,61 +55,145 @@ void pipeClose(Pipe* pi, int writable) {
     }
 
     if(pi->readopen == 0 && pi->writeopen == 0){
-        kfree(pi);
+        free_pipe(pi);
         return;
     }
     _release_spinlock(&pi->lock);
 }
 
+// copy at most n bytes between buf and the ring at byte counter pos,
+// without crossing a page of the ring. Caller must hold pi->lock.
+static u32 ring_copy(Pipe* pi, u32 pos, char* buf, u32 n, bool to_ring) {
+    u32 off = pos & (pi->size - 1);
+    char* p = pi->data[off / PAGE_SIZE] + off % PAGE_SIZE;
+    n = MIN(n, PAGE_SIZE - off % PAGE_SIZE);
+    if(to_ring)
+        memcpy(p, buf, n);
+    else
+        memcpy(buf, p, n);
+    return n;
+}
+
+/*
+ * Write all n bytes, sleeping while the pipe is full.
+ * Readers are only woken when the pipe goes from empty to non-empty.
+ */
 int pipeWrite(Pipe* pi, u64 addr, int n) {
     // TODO
     if(!pi->writeopen) return 0;
     char* src = (char*)addr;
     int i = 0;
+    bool wake = false;
     _acquire_spinlock(&pi->lock);
     while(i < n){
-        while(pi->nread + PIPESIZE == pi->nwrite){
-            if(pi->readopen == 0){
+        if(pi->nwrite - pi->nread == pi->size){
+            if(pi->readopen == 0)
+                break;
+            if(wake){
+                // readers may sleep on what we wrote, let them drain it first.
                 _release_spinlock(&pi->lock);
-                return i;
+                post_all_sem(&pi->rlock);
+                wake = false;
+                _acquire_spinlock(&pi->lock);
+                continue;
             }
-
             _lock_sem(&pi->wlock);
             _release_spinlock(&pi->lock);
-            post_all_sem(&pi->rlock);
             if(_wait_sem(&pi->wlock, true) == 0) return i;
             _acquire_spinlock(&pi->lock);
+            continue;
         }
-        pi->data[pi->nwrite++ % PIPESIZE] = src[i++];
+        if(pi->nwrite == pi->nread)
+            wake = true;
+        u32 t = MIN((u32)(n - i), pi->size - (pi->nwrite - pi->nread));
+        t = ring_copy(pi, pi->nwrite, src + i, t, true);
+        pi->nwrite += t;
+        i += t;
     }
     _release_spinlock(&pi->lock);
-    post_all_sem(&pi->rlock);
+    if(wake)
+        post_all_sem(&pi->rlock);
     return i;
 }
 
+/*
+ * Read up to n bytes, sleeping only while the pipe is empty.
+ * Writers are only woken when the pipe goes from full to non-full.
+ */
 int pipeRead(Pipe* pi, u64 addr, int n) {
     // TODO
     if(!pi->readopen) return 0;
     char* dst = (char*)addr;
     int i = 0;
     _acquire_spinlock(&pi->lock);
-    while(i < n){
-        while(pi->nread == pi->nwrite){
-            if(pi->writeopen == 0){
-                _release_spinlock(&pi->lock);
-                return i;
-            }
-
-            _lock_sem(&pi->rlock);
+    while(pi->nread == pi->nwrite){
+        if(pi->writeopen == 0){
             _release_spinlock(&pi->lock);
-            post_all_sem(&pi->wlock);
-            if(_wait_sem(&pi->rlock, true) == 0) return i;
-            _acquire_spinlock(&pi->lock);
+            return 0;
         }
-        dst[i++] = pi->data[pi->nread++ % PIPESIZE];
-        if(dst[i-1] == '\n') break;
+        _lock_sem(&pi->rlock);
+        _release_spinlock(&pi->lock);
+        if(_wait_sem(&pi->rlock, true) == 0) return 0;
+        _acquire_spinlock(&pi->lock);
+    }
+    bool wake = pi->nwrite - pi->nread == pi->size;
+    while(i < n && pi->nread != pi->nwrite){
+        u32 t = MIN((u32)(n - i), pi->nwrite - pi->nread);
+        t = ring_copy(pi, pi->nread, dst + i, t, false);
+        pi->nread += t;
+        i += t;
     }
     _release_spinlock(&pi->lock);
-    post_all_sem(&pi->wlock);
+    if(wake)
+        post_all_sem(&pi->wlock);
     return i;
-}
\ No newline at end of file
+}
+
+/*
+ * Set the capacity to size rounded up to a power of two number of pages.
+ * Return the new capacity, -EINVAL if it is larger than PIPE_MAX_PAGES,
+ * -EBUSY if it cannot hold the bytes currently in the pipe, or -ENOMEM.
+ */
+int pipeResize(Pipe* pi, usize size) {
+    if(size > PIPE_MAX_PAGES * PAGE_SIZE)
+        return -EINVAL;
+    u32 npages = 1;
+    while(npages * PAGE_SIZE < size)
+        npages <<= 1;
+    char* data[PIPE_MAX_PAGES];
+    for(u32 i = 0; i < npages; i++){
+        data[i] = kalloc_page();
+        if(data[i] == NULL){
+            while(i--)
+                kfree_page(data[i]);
+            return -ENOMEM;
+        }
+    }
+    _acquire_spinlock(&pi->lock);
+    u32 used = pi->nwrite - pi->nread;
+    if(used > npages * PAGE_SIZE){
+        _release_spinlock(&pi->lock);
+        for(u32 i = 0; i < npages; i++)
+            kfree_page(data[i]);
+        return -EBUSY;
+    }
+    // linearize the pending bytes into the new ring.
+    for(u32 done = 0; done < used;){
+        u32 t = MIN(used - done, PAGE_SIZE - done % PAGE_SIZE);
+        done += ring_copy(pi, pi->nread + done, data[done / PAGE_SIZE] + done % PAGE_SIZE, t, false);
+    }
+    bool wake = used == pi->size;
+    for(u32 i = 0; i < pi->size / PAGE_SIZE; i++){
+        kfree_page(pi->data[i]);
+        pi->data[i] = i < npages ? data[i] : NULL;
+    }
+    for(u32 i = pi->size / PAGE_SIZE; i < npages; i++)
+        pi->data[i] = data[i];
+    pi->size = npages * PAGE_SIZE;
+    pi->nread = 0;
+    pi->nwrite = used;
+    _release_spinlock(&pi->lock);
+    if(wake)
+        post_all_sem(&pi->wlock);
+    return npages * PAGE_SIZE;
+}
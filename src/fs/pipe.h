@@ -4,11 +4,14 @@
 #include <common/defines.h>
 #include <fs/file.h>
 #include <common/sem.h>
-#define PIPESIZE 512
+#include <aarch64/mmu.h>
+#define PIPESIZE PAGE_SIZE  // default capacity
+#define PIPE_MAX_PAGES 16    // capacity limit, in pages
 typedef struct pipe {
     SpinLock lock;
     Semaphore wlock,rlock;
-    char data[PIPESIZE];
+    char* data[PIPE_MAX_PAGES];  // ring of `size` bytes made of pages
+    u32 size;  // capacity, a power of two multiple of PAGE_SIZE
     u32 nread;  // number of bytes read
     u32 nwrite;  // number of bytes written
     int readopen;  // read fd is still open
@@ -18,4 +21,5 @@ int pipeAlloc(File** f0, File** f1);
 void pipeClose(Pipe* pi, int writable);
 int pipeWrite(Pipe* pi, u64 addr, int n);
 int pipeRead(Pipe* pi, u64 addr, int n);
+int pipeResize(Pipe* pi, usize size);
 #endif
\ No newline at end of file
@@ -227,6 +227,32 @@ void test_overflow() {
     assert_eq(panicked, true);
 }
 
+void test_large_op() {
+    initialize(100, 100);
+
+    OpContext ctx;
+    usize n = bcache.begin_large_op(&ctx, 60);
+    assert_eq(n, 60);
+
+    usize t = sblock.num_blocks - 1;
+    for (usize i = 0; i < n; i++) {
+        auto* b = bcache.acquire(t - i);
+        b->data[0] = 0xbb;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+    }
+    bcache.end_op(&ctx);
+
+    for (usize i = 0; i < n; i++) {
+        assert_eq(mock.inspect(t - i)[0], 0xbb);
+    }
+
+    // the reservation cannot outgrow the log.
+    n = bcache.begin_large_op(&ctx, 1000);
+    assert_true(n >= 60 && n <= 100);
+    bcache.end_op(&ctx);
+}
+
 void test_resident() {
     // NOTE: this test may be a little controversial.
     // the main ideas are:
@@ -465,6 +491,55 @@ void test_alloc_free() {
     }
 }
 
+void test_alloc_data() {
+    constexpr usize num_data_blocks = 100;
+
+    initialize(100, num_data_blocks);
+
+    // leave exactly one free block, and fill the others with 0xcc.
+    std::vector<usize> bno;
+    for (usize i = 0; i < num_data_blocks - 1; i++) {
+        OpContext ctx;
+        bcache.begin_op(&ctx);
+        usize no = bcache.alloc(&ctx);
+        auto* b = bcache.acquire(no);
+        b->data[0] = 0xcc;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+        bcache.end_op(&ctx);
+        bno.push_back(no);
+    }
+
+    // blocks freed by the running transaction are not reused around the log.
+    OpContext ctx;
+    bcache.begin_op(&ctx);
+    for (usize i = 0; i < 10; i++) {
+        bcache.free(&ctx, bno[i]);
+    }
+    usize no = bcache.alloc_data(&ctx);
+    for (usize i = 0; i < 10; i++) {
+        assert_ne(no, bno[i]);
+    }
+    bcache.free(&ctx, no);
+    bcache.end_op(&ctx);
+
+    // with more frees than the log keeps track of, the block may be one of
+    // them, so it is zeroed and kept in the log.
+    bcache.begin_op(&ctx);
+    for (usize i = 10; i < num_data_blocks - 1; i++) {
+        bcache.free(&ctx, bno[i]);
+    }
+    no = bcache.alloc_data(&ctx);
+    auto* b = bcache.acquire(no);
+    assert_eq(b->data[0], 0);
+    b->data[0] = 0xdd;
+    bcache.sync_data(&ctx, b);
+    bcache.release(b);
+    assert_ne(mock.inspect(no)[0], 0xdd);
+    bcache.end_op(&ctx);
+    assert_eq(mock.inspect(no)[0], 0xdd);
+}
+
 }  // namespace basic
 
 namespace concurrent {
@@ -889,12 +964,14 @@ int main() {
         {"lru", basic::test_lru},
         {"atomic_op", basic::test_atomic_op},
         {"overflow", basic::test_overflow},
+        {"large_op", basic::test_large_op},
         {"resident", basic::test_resident},
         {"local_absorption", basic::test_local_absorption},
         {"global_absorption", basic::test_global_absorption},
         {"replay", basic::test_replay},
         {"alloc", basic::test_alloc},
         {"alloc_free", basic::test_alloc_free},
+        {"alloc_data", basic::test_alloc_data},
 
         {"concurrent_acquire", concurrent::test_acquire},
         {"concurrent_sync", concurrent::test_sync},
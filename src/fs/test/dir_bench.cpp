@@ -0,0 +1,82 @@
+extern "C" {
+#include <fs/inode.h>
+}
+
+#include <chrono>
+#include <string>
+
+#include "assert.hpp"
+#include "runner.hpp"
+
+#include "mock/cache.hpp"
+
+// create and look up this number of names in one directory.
+static constexpr usize num_names = 10000;
+
+static OpContext _ctx, *ctx = &_ctx;
+
+static auto now() {
+    return std::chrono::steady_clock::now();
+}
+
+template <typename T>
+static void report(const char *what, T begin, usize acquires) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(now() - begin).count();
+    printf("(trace) %s: %zu names in %lld us, %.2f us/name, %.2f acquires/name\n",
+           what,
+           num_names,
+           static_cast<long long>(us),
+           static_cast<double>(us) / num_names,
+           static_cast<double>(acquires) / num_names);
+}
+
+void bench_dir() {
+    init_inodes(&sblock, &cache);
+
+    mock.begin_op(ctx);
+    usize dir = inodes.alloc(ctx, INODE_DIRECTORY);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto *p = inodes.get(dir);
+    inodes.lock(p);
+
+    // all names link to the same inode, so that the number of names is not
+    // limited by the number of inodes.
+    auto begin = now();
+    usize acquires = mock.num_acquires;
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_names; i++) {
+        auto name = std::to_string(i);
+        assert_ne(inodes.insert(ctx, p, name.data(), ino), static_cast<usize>(-1));
+    }
+    mock.end_op(ctx);
+    report("create", begin, mock.num_acquires - acquires);
+
+    begin = now();
+    acquires = mock.num_acquires;
+    for (usize i = 0; i < num_names; i++) {
+        auto name = std::to_string(i);
+        assert_eq(inodes.lookup(p, name.data(), NULL), ino);
+    }
+    report("lookup", begin, mock.num_acquires - acquires);
+
+    begin = now();
+    acquires = mock.num_acquires;
+    for (usize i = 0; i < num_names; i++) {
+        auto name = std::to_string(i) + "x";
+        assert_eq(inodes.lookup(p, name.data(), NULL), 0);
+    }
+    report("lookup (miss)", begin, mock.num_acquires - acquires);
+
+    inodes.unlock(p);
+}
+
+int main() {
+    std::vector<Testcase> tests = {
+        {"dir", bench_dir},
+    };
+    Runner(tests).run();
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+extern "C" {
+#include <fs/cache.h>
+}
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exception.hpp"
+
+// a disk image on the host, mapped into memory: either an image made by
+// `mkfs`, or `sd.img` from the build, whose second partition holds the
+// filesystem.
+struct FileBlockDevice {
+    int fd = -1;
+    u8 *map = nullptr;
+    usize map_size = 0;
+    u8 *base = nullptr;  // block 0 of the filesystem.
+    SuperBlock sblock;
+
+    std::atomic<usize> read_count;
+    std::atomic<usize> write_count;
+
+    using Hook = std::function<void(usize block_no, u8 *buffer)>;
+
+    Hook on_read;
+    Hook on_write;
+
+    // map the image at `path`. unless `writeback` is set, writes only
+    // change the mapping, so that every run starts from the same image.
+    void open(const std::string &path, bool writeback = false) {
+        close();
+        read_count = 0;
+        write_count = 0;
+
+        fd = ::open(path.data(), writeback ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            throw Internal("cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            throw Internal("cannot stat " + path);
+        map_size = st.st_size;
+        void *p = mmap(nullptr,
+                       map_size,
+                       PROT_READ | PROT_WRITE,
+                       writeback ? MAP_SHARED : MAP_PRIVATE,
+                       fd,
+                       0);
+        if (p == MAP_FAILED)
+            throw Internal("cannot map " + path);
+        map = static_cast<u8 *>(p);
+
+        base = find_filesystem();
+        if (base == nullptr)
+            throw Internal("no filesystem in " + path);
+        std::copy_n(base + BLOCK_SIZE, sizeof(sblock), reinterpret_cast<u8 *>(&sblock));
+        if (static_cast<usize>(base - map) + static_cast<usize>(sblock.num_blocks) * BLOCK_SIZE >
+            map_size)
+            throw Internal("filesystem exceeds " + path);
+    }
+
+    void close() {
+        if (map != nullptr) {
+            msync(map, map_size, MS_SYNC);
+            munmap(map, map_size);
+        }
+        if (fd >= 0)
+            ::close(fd);
+        map = base = nullptr;
+        fd = -1;
+    }
+
+    ~FileBlockDevice() {
+        close();
+    }
+
+    // the filesystem is either at the start of the image, or in the second
+    // partition of the MBR like on the SD card.
+    auto find_filesystem() -> u8 * {
+        if (is_filesystem(0))
+            return map;
+        if (map_size < SECTOR_SIZE || map[510] != 0x55 || map[511] != 0xaa)
+            return nullptr;
+        u32 lba;
+        std::copy_n(map + 0x1be + 16 + 8, sizeof(lba), reinterpret_cast<u8 *>(&lba));
+        usize offset = static_cast<usize>(lba) * SECTOR_SIZE;
+        return is_filesystem(offset) ? map + offset : nullptr;
+    }
+
+    bool is_filesystem(usize offset) {
+        SuperBlock sb;
+        if (offset + 2 * BLOCK_SIZE > map_size)
+            return false;
+        std::copy_n(map + offset + BLOCK_SIZE, sizeof(sb), reinterpret_cast<u8 *>(&sb));
+        return sb.magic == FS_MAGIC && sb.version == FS_VERSION && sb.block_size == BLOCK_SIZE;
+    }
+
+    auto at(usize block_no) -> u8 * {
+        if (block_no >= sblock.num_blocks)
+            throw AssertionFailure("block number is out of range");
+        return base + block_no * BLOCK_SIZE;
+    }
+
+    void read(usize block_no, u8 *buffer) {
+        u8 *data = at(block_no);
+        if (on_read)
+            on_read(block_no, buffer);
+        std::copy_n(data, BLOCK_SIZE, buffer);
+        read_count++;
+    }
+
+    void write(usize block_no, u8 *buffer) {
+        u8 *data = at(block_no);
+        if (on_write)
+            on_write(block_no, buffer);
+        std::copy_n(buffer, BLOCK_SIZE, data);
+        write_count++;
+    }
+};
+
+namespace {
+
+static FileBlockDevice image;
+static BlockDevice image_device;
+
+static void image_read(usize block_no, u8 *buffer) {
+    image.read(block_no, buffer);
+}
+
+static void image_write(usize block_no, u8 *buffer) {
+    image.write(block_no, buffer);
+}
+
+static void image_read_blocks(usize block_no, usize count, u8 *buffer) {
+    for (usize i = 0; i < count; i++) {
+        image.read(block_no + i, buffer + i * BLOCK_SIZE);
+    }
+}
+
+static void image_write_blocks(usize block_no, usize count, u8 *buffer) {
+    for (usize i = 0; i < count; i++) {
+        image.write(block_no + i, buffer + i * BLOCK_SIZE);
+    }
+}
+
+// like the mock device, the image completes every request before returning.
+static void image_submit(BlockRequest *req) {
+    if (req->write)
+        image_write_blocks(req->block_no, req->count, req->buffer);
+    else
+        image_read_blocks(req->block_no, req->count, req->buffer);
+    req->done(req);
+}
+
+// open the image at `path` and make `image_device` serve it.
+[[maybe_unused]] static void initialize_image(const std::string &path, bool writeback = false) {
+    image.open(path, writeback);
+    image_device.read = image_read;
+    image_device.write = image_write;
+    image_device.read_blocks = image_read_blocks;
+    image_device.write_blocks = image_write_blocks;
+    image_device.submit = image_submit;
+}
+
+}  // namespace
@@ -0,0 +1,462 @@
+extern "C" {
+#include <fs/inode.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "assert.hpp"
+#include "runner.hpp"
+
+#include "file_device.hpp"
+#include "mock/block_device.hpp"
+
+// runs workloads through the real inode layer and block cache on top of
+// `MockBlockDevice`, or a disk image, and reports for every phase:
+// * the number of operations and ops/s.
+// * latency percentiles of single operations.
+// * blocks read from and written to the device.
+// * the hit rate of `bcache.acquire`, as seen by the inode layer.
+//
+// usage: fs_bench [-r read_us] [-w write_us] [-n scale] [-o] [-i image] [workload...]
+// `-r`/`-w` inject latency into every block read/write of the device, `-n`
+// multiplies the size of all workloads and `-o` enables ordered-data mode.
+// `-i` runs the workloads in the root directory of an image made by `mkfs`
+// or `sd.img`, which is left unchanged.
+
+namespace {
+
+constexpr usize log_size = 200;
+constexpr usize num_inodes = 4096;
+constexpr usize num_data_blocks = 16384;
+
+struct Options {
+    usize read_us = 0;
+    usize write_us = 0;
+    usize scale = 1;
+    bool ordered = false;
+    std::string image;
+} opts;
+
+using Clock = std::chrono::steady_clock;
+
+static auto now() {
+    return Clock::now();
+}
+
+static double us_since(Clock::time_point begin) {
+    return std::chrono::duration<double, std::micro>(now() - begin).count();
+}
+
+// blocks read from and written to the device so far.
+static usize num_reads() {
+    return opts.image.empty() ? mock.read_count.load() : image.read_count.load();
+}
+
+static usize num_writes() {
+    return opts.image.empty() ? mock.write_count.load() : image.write_count.load();
+}
+
+// `bcache.acquire` is wrapped to count hits and misses: a miss reads the block
+// from the device.
+static Block *(*cache_acquire)(usize block_no);
+static usize num_acquires, num_misses;
+
+static Block *counting_acquire(usize block_no) {
+    usize read_count = num_reads();
+    auto *b = cache_acquire(block_no);
+    num_acquires++;
+    if (num_reads() != read_count)
+        num_misses++;
+    return b;
+}
+
+// a fresh filesystem with an empty root directory on the mock device.
+static void format() {
+    usize num_inode_blocks = (num_inodes + INODE_PER_BLOCK - 1) / INODE_PER_BLOCK;
+    usize num_bitmap_blocks = (num_data_blocks + BIT_PER_BLOCK - 1) / BIT_PER_BLOCK;
+    sblock.magic = FS_MAGIC;
+    sblock.version = FS_VERSION;
+    sblock.block_size = BLOCK_SIZE;
+    sblock.log_start = 2;
+    sblock.num_log_blocks = 1 + log_size;
+    sblock.inode_start = sblock.log_start + sblock.num_log_blocks;
+    sblock.bitmap_start = sblock.inode_start + num_inode_blocks;
+    sblock.num_inodes = num_inodes;
+    sblock.num_data_blocks = num_data_blocks;
+    sblock.num_blocks = sblock.bitmap_start + num_bitmap_blocks + num_data_blocks;
+
+    mock.initialize(sblock);
+    for (usize i = 0; i < num_inode_blocks; i++) {
+        mock.disk[sblock.inode_start + i].fill_zero();
+    }
+    auto *root = reinterpret_cast<InodeEntry *>(mock.inspect(sblock.inode_start)) + ROOT_INODE_NO;
+    root->type = INODE_DIRECTORY;
+    root->num_links = 1;
+
+    device.read = stub_read;
+    device.write = stub_write;
+    device.read_blocks = stub_read_blocks;
+    device.write_blocks = stub_write_blocks;
+    device.submit = stub_submit;
+}
+
+static void setup() {
+    MockBlockDevice::Hook on_read, on_write;
+    if (opts.read_us > 0) {
+        on_read = [](usize, u8 *) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.read_us));
+        };
+    }
+    if (opts.write_us > 0) {
+        on_write = [](usize, u8 *) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.write_us));
+        };
+    }
+
+    if (opts.image.empty()) {
+        format();
+        mock.on_read = on_read;
+        mock.on_write = on_write;
+        init_bcache(&sblock, &device);
+    } else {
+        initialize_image(opts.image);
+        image.on_read = on_read;
+        image.on_write = on_write;
+        sblock = image.sblock;
+        init_bcache(&sblock, &image_device);
+    }
+    cache_acquire = bcache.acquire;
+    bcache.acquire = counting_acquire;
+    init_inodes(&sblock, &bcache);
+    set_ordered_data(opts.ordered);
+}
+
+// one measured part of a workload.
+class Phase {
+public:
+    explicit Phase(const char *_name)
+        : name(_name),
+          begin(now()),
+          read_count(num_reads()),
+          write_count(num_writes()),
+          acquires(num_acquires),
+          misses(num_misses) {}
+
+    template <typename F>
+    void op(F &&f) {
+        auto t = now();
+        f();
+        latencies.push_back(us_since(t));
+    }
+
+    void report() {
+        double elapsed = us_since(begin);
+        usize n = latencies.size();
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return n == 0 ? 0.0 : latencies[std::min(n - 1, static_cast<usize>(p * n))];
+        };
+        usize hits = (num_acquires - acquires) - (num_misses - misses);
+        usize total = num_acquires - acquires;
+
+        printf("(trace) %-14s %6llu ops %10.1f ops/s | p50 %8.1f p90 %8.1f p99 %8.1f max %8.1f us"
+               " | %7llu reads %7llu writes | hit %5.1f%%\n",
+               name,
+               static_cast<unsigned long long>(n),
+               elapsed > 0 ? n * 1e6 / elapsed : 0.0,
+               percentile(0.5),
+               percentile(0.9),
+               percentile(0.99),
+               n == 0 ? 0.0 : latencies.back(),
+               static_cast<unsigned long long>(num_reads() - read_count),
+               static_cast<unsigned long long>(num_writes() - write_count),
+               total == 0 ? 0.0 : 100.0 * hits / total);
+    }
+
+private:
+    const char *name;
+    Clock::time_point begin;
+    usize read_count, write_count, acquires, misses;
+    std::vector<double> latencies;
+};
+
+// like `create` in `sysfile.c`. return the locked inode.
+static Inode *create(OpContext *ctx, const std::string &path, InodeType type) {
+    char name[FILE_NAME_MAX_LENGTH];
+    auto *dp = nameiparent(path.data(), name, ctx);
+    assert_true(dp != NULL);
+
+    inodes.lock(dp);
+    usize ino = inodes.alloc(ctx, type);
+    assert_ne(inodes.insert(ctx, dp, name, ino), static_cast<usize>(-1));
+    if (type == INODE_DIRECTORY) {
+        dp->entry.num_links++;
+        inodes.sync(ctx, dp, true);
+    }
+    inodes.unlock(dp);
+
+    auto *ip = inodes.get(ino);
+    inodes.lock(ip);
+    ip->entry.num_links = 1;
+    inodes.sync(ctx, ip, true);
+    if (type == INODE_DIRECTORY) {
+        inodes.insert(ctx, ip, ".", ino);
+        inodes.insert(ctx, ip, "..", dp->inode_no);
+    }
+    inodes.put(ctx, dp);
+    return ip;
+}
+
+// like `unlinkat` in `sysfile.c`, for regular files.
+static void unlink(OpContext *ctx, const std::string &path) {
+    char name[FILE_NAME_MAX_LENGTH];
+    usize index;
+    auto *dp = nameiparent(path.data(), name, ctx);
+    assert_true(dp != NULL);
+
+    inodes.lock(dp);
+    usize ino = inodes.lookup(dp, name, &index);
+    assert_ne(ino, 0);
+    inodes.remove(ctx, dp, index);
+    inodes.unlock(dp);
+    inodes.put(ctx, dp);
+
+    auto *ip = inodes.get(ino);
+    inodes.lock(ip);
+    ip->entry.num_links--;
+    inodes.sync(ctx, ip, true);
+    inodes.unlock(ip);
+    inodes.put(ctx, ip);
+}
+
+// like `open` and `read` in `sysfile.c`.
+static void read_file(const std::string &path, u8 *buf, usize size) {
+    OpContext ctx;
+    bcache.begin_op(&ctx);
+    auto *ip = namei(path.data(), &ctx);
+    assert_true(ip != NULL);
+    bcache.end_op(&ctx);
+
+    inodes.lock(ip);
+    for (usize offset = 0; offset < size;) {
+        usize n = inodes.read(ip, buf, offset, size - offset);
+        assert_ne(n, 0);
+        offset += n;
+    }
+    inodes.unlock(ip);
+
+    bcache.begin_op(&ctx);
+    inodes.put(&ctx, ip);
+    bcache.end_op(&ctx);
+}
+
+// many small files: create and write each of them in one atomic operation,
+// which is durable when `end_op` returns, then read and unlink them.
+void bench_small() {
+    setup();
+
+    constexpr usize file_size = 1024;
+    // half of the inodes at most, for the small images of `mkfs`.
+    usize num_files = std::min<usize>(1000 * opts.scale, sblock.num_inodes / 2);
+    std::vector<u8> buf(file_size, 0x5a);
+    auto path = [](usize i) { return "/f" + std::to_string(i); };
+
+    Phase create_phase("create+fsync");
+    for (usize i = 0; i < num_files; i++) {
+        create_phase.op([&] {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            auto *ip = create(&ctx, path(i), INODE_REGULAR);
+            assert_eq(inodes.write(&ctx, ip, buf.data(), 0, file_size), file_size);
+            inodes.unlock(ip);
+            inodes.put(&ctx, ip);
+            bcache.end_op(&ctx);
+        });
+    }
+    create_phase.report();
+
+    Phase read_phase("read");
+    for (usize i = 0; i < num_files; i++) {
+        read_phase.op([&] { read_file(path(i), buf.data(), file_size); });
+    }
+    read_phase.report();
+
+    Phase unlink_phase("unlink");
+    for (usize i = 0; i < num_files; i++) {
+        unlink_phase.op([&] {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            unlink(&ctx, path(i));
+            bcache.end_op(&ctx);
+        });
+    }
+    unlink_phase.report();
+}
+
+// one large file: appended like `filewrite` does for regular files, i.e.
+// through `write_delayed` and `flush`, then read sequentially and deleted.
+void bench_large() {
+    setup();
+
+    constexpr usize chunk_size = 64 * 1024;
+    usize num_chunks = 64 * opts.scale;
+    std::vector<u8> buf(chunk_size, 0xa5);
+
+    OpContext ctx;
+    bcache.begin_op(&ctx);
+    auto *ip = create(&ctx, "/large", INODE_REGULAR);
+    inodes.unlock(ip);
+    bcache.end_op(&ctx);
+
+    auto flush = [&] {
+        bcache.begin_large_op(&ctx, INODE_MAX_DELAYED_BLOCKS + 16);
+        inodes.lock(ip);
+        inodes.flush(&ctx, ip);
+        inodes.unlock(ip);
+        bcache.end_op(&ctx);
+    };
+
+    Phase write_phase("seq write");
+    for (usize i = 0; i < num_chunks; i++) {
+        write_phase.op([&] {
+            usize offset = i * chunk_size;
+            for (usize count = 0; count < chunk_size;) {
+                usize alloc_end;
+                inodes.lock(ip);
+                usize n = inodes.write_delayed(ip, buf.data() + count, offset + count,
+                                               chunk_size - count, &alloc_end);
+                inodes.unlock(ip);
+                if (n == 0)
+                    flush();
+                count += n;
+            }
+        });
+    }
+    write_phase.op(flush);
+    write_phase.report();
+
+    Phase read_phase("seq read");
+    for (usize i = 0; i < num_chunks; i++) {
+        read_phase.op([&] {
+            inodes.lock(ip);
+            assert_eq(inodes.read(ip, buf.data(), i * chunk_size, chunk_size), chunk_size);
+            inodes.unlock(ip);
+        });
+    }
+    read_phase.report();
+
+    Phase delete_phase("delete");
+    delete_phase.op([&] {
+        bcache.begin_large_op(&ctx, 2 * OP_MAX_NUM_BLOCKS);
+        unlink(&ctx, "/large");
+        inodes.put(&ctx, ip);
+        bcache.end_op(&ctx);
+    });
+    delete_phase.report();
+}
+
+// a deep directory tree: a chain of directories, each with a few files,
+// then path lookups from the root to random depths.
+void bench_tree() {
+    setup();
+
+    constexpr usize depth = 32;
+    usize files_per_dir = std::min<usize>(8, sblock.num_inodes / 2 / depth);
+    usize num_lookups = 2000 * opts.scale;
+
+    std::vector<std::string> dirs = {""};
+    for (usize i = 0; i < depth; i++) {
+        dirs.push_back(dirs.back() + "/d" + std::to_string(i));
+    }
+
+    Phase mkdir_phase("mkdir");
+    for (usize i = 1; i <= depth; i++) {
+        mkdir_phase.op([&] {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            auto *ip = create(&ctx, dirs[i], INODE_DIRECTORY);
+            inodes.unlock(ip);
+            inodes.put(&ctx, ip);
+            bcache.end_op(&ctx);
+        });
+    }
+    mkdir_phase.report();
+
+    Phase create_phase("create");
+    for (usize i = 1; i <= depth; i++) {
+        for (usize j = 0; j < files_per_dir; j++) {
+            create_phase.op([&] {
+                OpContext ctx;
+                bcache.begin_op(&ctx);
+                auto *ip = create(&ctx, dirs[i] + "/f" + std::to_string(j), INODE_REGULAR);
+                inodes.unlock(ip);
+                inodes.put(&ctx, ip);
+                bcache.end_op(&ctx);
+            });
+        }
+    }
+    create_phase.report();
+
+    std::mt19937 gen(0x19260817);
+    Phase lookup_phase("lookup");
+    for (usize i = 0; i < num_lookups; i++) {
+        auto path = dirs[1 + gen() % depth] + "/f" + std::to_string(gen() % files_per_dir);
+        lookup_phase.op([&] {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            auto *ip = namei(path.data(), &ctx);
+            assert_true(ip != NULL);
+            inodes.put(&ctx, ip);
+            bcache.end_op(&ctx);
+        });
+    }
+    lookup_phase.report();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    // `Runner` forks, which must not duplicate buffered output.
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int c;
+    while ((c = getopt(argc, argv, "r:w:n:oi:")) != -1) {
+        switch (c) {
+            case 'r': opts.read_us = std::stoull(optarg); break;
+            case 'w': opts.write_us = std::stoull(optarg); break;
+            case 'n': opts.scale = std::max(1ull, std::stoull(optarg)); break;
+            case 'o': opts.ordered = true; break;
+            case 'i': opts.image = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-r read_us] [-w write_us] [-n scale] [-o] [-i image] "
+                        "[workload...]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<Testcase> workloads = {
+        {"small", bench_small},
+        {"large", bench_large},
+        {"tree", bench_tree},
+    };
+
+    std::vector<Testcase> tests;
+    for (const auto &workload : workloads) {
+        bool selected = optind == argc;
+        for (int i = optind; i < argc; i++) {
+            selected |= workload.name == argv[i];
+        }
+        if (selected)
+            tests.push_back(workload);
+    }
+    Runner(tests).run();
+
+    return 0;
+}
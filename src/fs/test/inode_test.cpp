@@ -176,6 +176,46 @@ void test_share() {
     assert_eq(mock.count_inodes(), 1);
 }
 
+void test_warm() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+    p->entry.num_links = 1;
+    mock.begin_op(ctx);
+    inodes.sync(ctx, p, true);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    // a linked inode stays in memory after its last reference is dropped.
+    auto* q = inodes.get(ino);
+    assert_eq(p, q);
+    assert_eq(q->rc.count, 1);
+
+    inodes.lock(q);
+    q->entry.num_links = 0;
+    mock.begin_op(ctx);
+    inodes.sync(ctx, q, true);
+    inodes.unlock(q);
+    inodes.put(ctx, q);
+    mock.end_op(ctx);
+    assert_eq(mock.count_inodes(), 1);
+
+    // the freed inode number is handed out again.
+    mock.begin_op(ctx);
+    assert_eq(inodes.alloc(ctx, INODE_REGULAR), ino);
+    mock.end_op(ctx);
+
+    p = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_inodes(), 1);
+}
+
 void test_small_file() {
     mock.begin_op(ctx);
     usize ino = inodes.alloc(ctx, INODE_REGULAR);
@@ -310,6 +350,362 @@ void test_large_file() {
     assert_eq(mock.count_blocks(), 0);
 }
 
+void test_huge_file() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    // reach into the first indirect block under `double_indirect`.
+    constexpr usize max_size =
+        (INODE_NUM_DIRECT + INODE_NUM_INDIRECT + 7) * BLOCK_SIZE + 123;
+    static u8 buf[max_size], copy[max_size];
+    std::mt19937 gen(0xdeadbeef);
+    for (usize i = 0; i < max_size; i++) {
+        copy[i] = buf[i] = gen() & 0xff;
+    }
+
+    auto* p = inodes.get(ino);
+
+    inodes.lock(p);
+    for (usize i = 0, n = 0; i < max_size; i += n) {
+        n = std::min(static_cast<usize>(gen() % 100000), max_size - i);
+        mock.begin_op(ctx);
+        inodes.write(ctx, p, buf + i, i, n);
+        mock.end_op(ctx);
+    }
+    inodes.unlock(p);
+
+    auto* q = mock.inspect(ino);
+    assert_eq(q->num_bytes, max_size);
+    assert_ne(q->indirect, 0);
+    assert_ne(q->double_indirect, 0);
+
+    for (usize i = 0; i < max_size; i++) {
+        buf[i] = 0;
+    }
+
+    inodes.lock(p);
+    inodes.read(p, buf, 0, max_size);
+    for (usize i = 0, n = 0; i < max_size; i += n) {
+        n = std::min(static_cast<usize>(gen() % 10000), max_size - i);
+        inodes.read(p, buf + i, i, n);
+    }
+    inodes.unlock(p);
+
+    for (usize i = 0; i < max_size; i++) {
+        assert_eq(buf[i], copy[i]);
+    }
+
+    inodes.lock(p);
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    mock.end_op(ctx);
+
+    q = mock.inspect(ino);
+    assert_eq(q->num_bytes, 0);
+    assert_eq(q->indirect, 0);
+    assert_eq(q->double_indirect, 0);
+    assert_eq(mock.count_blocks(), 0);
+
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_inodes(), 1);
+}
+
+void test_ordered() {
+    set_ordered_data(true);
+
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    constexpr usize size = 3 * BLOCK_SIZE + 100;
+    static u8 buf[size], copy[size];
+    std::mt19937 gen(0x0dde4ed);
+    for (usize i = 0; i < size; i++) {
+        copy[i] = buf[i] = gen() & 0xff;
+    }
+
+    auto* p = inodes.get(ino);
+
+    inodes.lock(p);
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 0, size);
+
+    // data is on disk before the operation commits, the inode is not.
+    auto* q = mock.inspect(ino);
+    assert_eq(q->num_bytes, 0);
+    auto* d = mock.inspect_block(p->entry.addrs[3]);
+    for (usize i = 0; i < BLOCK_SIZE; i++) {
+        assert_eq(d[i], i < 100 ? copy[3 * BLOCK_SIZE + i] : 0);
+    }
+
+    mock.end_op(ctx);
+    assert_eq(q->num_bytes, size);
+
+    for (usize i = 0; i < size; i++) {
+        buf[i] = 0;
+    }
+    inodes.read(p, buf, 0, size);
+    for (usize i = 0; i < size; i++) {
+        assert_eq(buf[i], copy[i]);
+    }
+
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    set_ordered_data(false);
+    assert_eq(mock.count_inodes(), 1);
+    assert_eq(mock.count_blocks(), 0);
+}
+
+void test_path() {
+    mock.begin_op(ctx);
+    usize dir = inodes.alloc(ctx, INODE_DIRECTORY);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto* root = inodes.get(ROOT_INODE_NO);
+    auto* p = inodes.get(dir);
+    auto* f = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.lock(root);
+    inodes.insert(ctx, root, "d", dir);
+    inodes.unlock(root);
+    inodes.lock(p);
+    inodes.insert(ctx, p, "f", ino);
+    p->entry.num_links = 1;
+    inodes.sync(ctx, p, true);
+    inodes.unlock(p);
+    inodes.lock(f);
+    f->entry.num_links = 1;
+    inodes.sync(ctx, f, true);
+    inodes.unlock(f);
+    mock.end_op(ctx);
+
+    // the second walk is served by the dentry cache.
+    for (int i = 0; i < 2; i++) {
+        auto* q = namei("/d/f", ctx);
+        assert_ne(q, static_cast<Inode*>(NULL));
+        assert_eq(q->inode_no, ino);
+        inodes.put(ctx, q);
+        assert_eq(namei("/d/g", ctx), static_cast<Inode*>(NULL));
+    }
+
+    usize index;
+    mock.begin_op(ctx);
+    inodes.lock(p);
+    assert_eq(inodes.lookup(p, "f", &index), ino);
+    inodes.remove(ctx, p, index);
+    inodes.insert(ctx, p, "g", ino);
+    inodes.unlock(p);
+    mock.end_op(ctx);
+
+    assert_eq(namei("/d/f", ctx), static_cast<Inode*>(NULL));
+    auto* q = namei("/d/g", ctx);
+    assert_ne(q, static_cast<Inode*>(NULL));
+    assert_eq(q->inode_no, ino);
+
+    char name[FILE_NAME_MAX_LENGTH];
+    auto* r = nameiparent("/d/g", name, ctx);
+    assert_eq(r, p);
+    assert_eq(std::string(name), "g");
+    inodes.put(ctx, r);
+
+    // clearing the directory drops its cached names.
+    mock.begin_op(ctx);
+    inodes.lock(p);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    mock.end_op(ctx);
+    assert_eq(namei("/d/g", ctx), static_cast<Inode*>(NULL));
+
+    mock.begin_op(ctx);
+    inodes.put(ctx, q);
+    inodes.lock(f);
+    f->entry.num_links = 0;
+    inodes.unlock(f);
+    inodes.put(ctx, f);
+    inodes.lock(p);
+    p->entry.num_links = 0;
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    inodes.put(ctx, root);
+    mock.end_op(ctx);
+    assert_eq(mock.count_inodes(), 1);
+}
+
+void test_large_dir() {
+    mock.begin_op(ctx);
+    usize dir = inodes.alloc(ctx, INODE_DIRECTORY);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    // large enough to span several blocks and be indexed.
+    constexpr usize num_names = 2000;
+    auto* p = inodes.get(dir);
+    inodes.lock(p);
+
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_names; i++) {
+        auto name = "n" + std::to_string(i);
+        assert_eq(inodes.insert(ctx, p, name.data(), ino), i * sizeof(DirEntry));
+    }
+    assert_eq(inodes.insert(ctx, p, "n0", ino), static_cast<usize>(-1));
+    mock.end_op(ctx);
+
+    usize num_bytes = p->entry.num_bytes;
+    assert_eq(num_bytes, num_names * sizeof(DirEntry));
+
+    for (usize i = 0; i < num_names; i++) {
+        usize index = 0;
+        auto name = "n" + std::to_string(i);
+        assert_eq(inodes.lookup(p, name.data(), &index), ino);
+        assert_eq(index, i * sizeof(DirEntry));
+    }
+    assert_eq(inodes.lookup(p, "n2000", NULL), 0);
+
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_names; i += 3) {
+        inodes.remove(ctx, p, i * sizeof(DirEntry));
+    }
+    mock.end_op(ctx);
+
+    for (usize i = 0; i < num_names; i++) {
+        auto name = "n" + std::to_string(i);
+        assert_eq(inodes.lookup(p, name.data(), NULL), i % 3 == 0 ? 0 : ino);
+    }
+
+    // new names fill the holes before the directory grows.
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_names; i += 3) {
+        auto name = "m" + std::to_string(i);
+        assert_eq(inodes.insert(ctx, p, name.data(), ino), i * sizeof(DirEntry));
+    }
+    assert_eq(inodes.insert(ctx, p, "extra", ino), num_bytes);
+    mock.end_op(ctx);
+
+    for (usize i = 0; i < num_names; i += 3) {
+        auto name = "m" + std::to_string(i);
+        assert_eq(inodes.lookup(p, name.data(), NULL), ino);
+    }
+
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    auto* q = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.put(ctx, q);
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_inodes(), 1);
+    assert_eq(mock.count_blocks(), 0);
+}
+
+void test_delayed() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    constexpr usize size = 5 * BLOCK_SIZE + 300;
+    static u8 buf[size], copy[size];
+    std::mt19937 gen(0xde1a7ed);
+    for (usize i = 0; i < size; i++) {
+        copy[i] = buf[i] = gen() & 0xff;
+    }
+
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+
+    // small appends only go to memory.
+    usize alloc_end = 233;
+    for (usize i = 0; i < size; i += 100) {
+        usize n = std::min(size - i, static_cast<usize>(100));
+        assert_eq(inodes.write_delayed(p, buf + i, i, n, &alloc_end), n);
+        assert_eq(alloc_end, 0);
+    }
+    assert_eq(p->entry.num_bytes, size);
+    assert_eq(mock.count_blocks(), 0);
+
+    mock.begin_op(ctx);
+    inodes.sync(ctx, p, true);
+    mock.end_op(ctx);
+    auto* q = mock.inspect(ino);
+    assert_eq(q->num_bytes, 0);
+
+    for (usize i = 0; i < size; i++) {
+        buf[i] = 0;
+    }
+    assert_eq(inodes.read(p, buf, 0, size), size);
+    for (usize i = 0; i < size; i++) {
+        assert_eq(buf[i], copy[i]);
+    }
+
+    // the blocks are allocated together on flush.
+    mock.begin_op(ctx);
+    inodes.flush(ctx, p);
+    mock.end_op(ctx);
+    assert_true(p->delayed == NULL);
+    assert_eq(q->num_bytes, size);
+    assert_eq(mock.count_blocks(), 6);
+    for (usize i = 1; i < 6; i++) {
+        assert_eq(q->addrs[i], q->addrs[0] + i);
+    }
+
+    // appends inside the last allocated block are not delayed.
+    assert_eq(inodes.write_delayed(p, buf, size, 1, &alloc_end), 0);
+    assert_eq(alloc_end, 6 * BLOCK_SIZE);
+
+    for (usize i = 0; i < size; i++) {
+        buf[i] = 0;
+    }
+    assert_eq(inodes.read(p, buf, 0, size), size);
+    for (usize i = 0; i < size; i++) {
+        assert_eq(buf[i], copy[i]);
+    }
+
+    // delayed data of a removed file never reaches the disk.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, size, 6 * BLOCK_SIZE - size);
+    mock.end_op(ctx);
+    assert_eq(inodes.write_delayed(p, buf, 6 * BLOCK_SIZE, 100, &alloc_end), 100);
+    assert_eq(alloc_end, 6 * BLOCK_SIZE);
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_inodes(), 1);
+    assert_eq(mock.count_blocks(), 0);
+
+    // the last reference to a linked file flushes what is left.
+    mock.begin_op(ctx);
+    ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+    p = inodes.get(ino);
+    inodes.lock(p);
+    p->entry.num_links = 1;
+    assert_eq(inodes.write_delayed(p, copy, 0, 100, &alloc_end), 100);
+    inodes.unlock(p);
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    q = mock.inspect(ino);
+    assert_eq(q->num_bytes, 100);
+    assert_eq(mock.count_blocks(), 1);
+}
+
 void test_dir() {
     usize ino[5] = {1};
 
@@ -412,9 +808,15 @@ int main() {
         {"sync", adhoc::test_sync},
         {"touch", adhoc::test_touch},
         {"share", adhoc::test_share},
+        {"warm", adhoc::test_warm},
         {"small_file", adhoc::test_small_file},
         {"large_file", adhoc::test_large_file},
+        {"huge_file", adhoc::test_huge_file},
+        {"ordered", adhoc::test_ordered},
+        {"delayed", adhoc::test_delayed},
         {"dir", adhoc::test_dir},
+        {"large_dir", adhoc::test_large_dir},
+        {"path", adhoc::test_path},
     };
     Runner(tests).run();
 
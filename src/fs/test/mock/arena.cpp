@@ -18,4 +18,12 @@ void* kalloc(isize x) {
 void kfree(void* object) {
     free(object);
 }
+
+void* kalloc_page() {
+    return aligned_alloc(4096, 4096);
+}
+
+void kfree_page(void* page) {
+    free(page);
+}
 }
@@ -14,6 +14,27 @@ static void stub_write(usize block_no, u8 *buffer) {
     mock.write(block_no, buffer);
 }
 
+static void stub_read_blocks(usize block_no, usize count, u8 *buffer) {
+    for (usize i = 0; i < count; i++) {
+        mock.read(block_no + i, buffer + i * BLOCK_SIZE);
+    }
+}
+
+static void stub_write_blocks(usize block_no, usize count, u8 *buffer) {
+    for (usize i = 0; i < count; i++) {
+        mock.write(block_no + i, buffer + i * BLOCK_SIZE);
+    }
+}
+
+// the mock device completes every request before returning.
+static void stub_submit(BlockRequest *req) {
+    if (req->write)
+        stub_write_blocks(req->block_no, req->count, req->buffer);
+    else
+        stub_read_blocks(req->block_no, req->count, req->buffer);
+    req->done(req);
+}
+
 static void initialize_mock(  //
     usize log_size,
     usize num_data_blocks,
@@ -31,6 +52,9 @@ static void initialize_mock(  //
 
     device.read = stub_read;
     device.write = stub_write;
+    device.read_blocks = stub_read_blocks;
+    device.write_blocks = stub_write_blocks;
+    device.submit = stub_submit;
 
     if (!image_path.empty())
         mock.load(image_path);
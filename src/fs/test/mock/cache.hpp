@@ -13,13 +13,16 @@ extern "C" {
 #include "../exception.hpp"
 
 struct MockBlockCache {
-    static constexpr usize num_blocks = 2000;
+    static constexpr usize num_blocks = 3000;
     static constexpr usize inode_start = 200;
     static constexpr usize block_start = 1000;
     static constexpr usize num_inodes = 1000;
 
     static auto get_sblock() -> SuperBlock {
         SuperBlock sblock;
+        sblock.magic = FS_MAGIC;
+        sblock.version = FS_VERSION;
+        sblock.block_size = BLOCK_SIZE;
         sblock.num_blocks = num_blocks;
         sblock.num_data_blocks = num_blocks - block_start;
         sblock.num_inodes = num_inodes;
@@ -27,6 +30,7 @@ struct MockBlockCache {
         sblock.log_start = 2;
         sblock.inode_start = inode_start;
         sblock.bitmap_start = 900;
+        sblock.flags = 0;
         return sblock;
     }
 
@@ -46,9 +50,16 @@ struct MockBlockCache {
         usize index;
         std::mutex mutex;
         Block block;
+        u8 data[BLOCK_SIZE];
+
+        Cell() {
+            block.data = data;
+        }
 
         auto operator=(const Cell &rhs) -> Cell & {
             block = rhs.block;
+            block.data = data;
+            std::copy(std::begin(rhs.data), std::end(rhs.data), data);
             return *this;
         }
 
@@ -75,6 +86,9 @@ struct MockBlockCache {
     std::atomic<usize> oracle, top_oracle;
     std::unordered_map<usize, bool> scoreboard;
 
+    // number of `acquire` calls, for benchmarks.
+    std::atomic<usize> num_acquires{0};
+
     // mbit: bitmap cached in memory, which is volatile
     // sbit: bitmap on SD card, which is persistent
     // mblk: data blocks cached in memory, volatile
@@ -117,6 +131,7 @@ struct MockBlockCache {
                 node[i].addrs[j] = gen();
             }
             node[i].indirect = gen();
+            node[i].double_indirect = gen();
         }
 
         // mock root inode.
@@ -129,6 +144,7 @@ struct MockBlockCache {
             node[1].addrs[i] = 0;
         }
         node[1].indirect = 0;
+        node[1].double_indirect = 0;
 
         usize step = 0;
         for (usize i = 0, j = inode_start; i < num_inodes; i += step, j++) {
@@ -197,6 +213,11 @@ struct MockBlockCache {
         return &arr[k];
     }
 
+    // inspect on disk content of block `i`.
+    auto inspect_block(usize i) -> u8 * {
+        return sblk[i].block.data;
+    }
+
     void check_block_no(usize i) {
         if (i >= num_blocks)
             throw AssertionFailure("block number out of range");
@@ -295,6 +316,16 @@ struct MockBlockCache {
         throw AssertionFailure("no free block");
     }
 
+    // like `alloc`, but leave stale content in the block as a real disk would.
+    auto alloc_data(OpContext *ctx) -> usize {
+        usize i = alloc(ctx);
+        std::scoped_lock guard(mblk[i].mutex);
+        for (usize j = 0; j < BLOCK_SIZE; j++) {
+            mblk[i].block.data[j] = 0xcc;
+        }
+        return i;
+    }
+
     void free(OpContext *ctx, usize i) {
         check_block_no(i);
 
@@ -310,6 +341,7 @@ struct MockBlockCache {
 
     auto acquire(usize i) -> Block * {
         check_block_no(i);
+        num_acquires++;
 
         mblk[i].mutex.lock();
 
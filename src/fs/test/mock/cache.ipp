@@ -10,6 +10,11 @@ static void stub_begin_op(OpContext *ctx) {
     mock.begin_op(ctx);
 }
 
+static usize stub_begin_large_op(OpContext *ctx, usize num_blocks) {
+    mock.begin_op(ctx);
+    return num_blocks;
+}
+
 static void stub_end_op(OpContext *ctx) {
     mock.end_op(ctx);
 }
@@ -18,6 +23,10 @@ static usize stub_alloc(OpContext *ctx) {
     return mock.alloc(ctx);
 }
 
+static usize stub_alloc_data(OpContext *ctx) {
+    return mock.alloc_data(ctx);
+}
+
 static void stub_free(OpContext *ctx, usize block_no) {
     mock.free(ctx, block_no);
 }
@@ -34,16 +43,24 @@ static void stub_sync(OpContext *ctx, Block *block) {
     mock.sync(ctx, block);
 }
 
+static void stub_sync_data(OpContext *ctx, Block *block) {
+    (void)ctx;
+    mock.sync(nullptr, block);
+}
+
 static struct _Loader {
     _Loader() {
         sblock = mock.get_sblock();
 
         cache.begin_op = stub_begin_op;
+        cache.begin_large_op = stub_begin_large_op;
         cache.end_op = stub_end_op;
         cache.alloc = stub_alloc;
+        cache.alloc_data = stub_alloc_data;
         cache.free = stub_free;
         cache.acquire = stub_acquire;
         cache.release = stub_release;
         cache.sync = stub_sync;
+        cache.sync_data = stub_sync_data;
     }
 } _loader;
@@ -0,0 +1,220 @@
+extern "C" {
+#include <fs/cache.h>
+}
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "mock/block_device.hpp"
+
+// feeds a block I/O trace dumped by `blktrace` (see `block_trace_dump`)
+// back into the block cache and the log on top of `MockBlockDevice`, so
+// that changes to them can be compared on the same recorded workload.
+//
+// every traced read becomes `acquire`/`release` of its blocks, and every
+// traced write becomes `sync` of its blocks in an atomic operation. writes
+// to the log area are not replayed, since the log writes its own: a write
+// of the log header ends the atomic operation, as it did when the trace
+// was taken. blocks beyond the filesystem, e.g. swap, are skipped.
+//
+// `MockBlockDevice` serves requests as they come, with no queue to sort or
+// merge them: how the SD card's elevator handles the trace is measured on
+// the board instead, with `blktrace -r`.
+//
+// usage: trace_replay [-r read_us] [-w write_us] [-t] trace
+// `-r`/`-w` inject latency into every block read/write of the device, and
+// `-t` issues records no earlier than their offset in the trace.
+
+namespace {
+
+struct Options {
+    usize read_us = 0;
+    usize write_us = 0;
+    bool timed = false;
+} opts;
+
+using Clock = std::chrono::steady_clock;
+
+static Block *(*cache_acquire)(usize block_no);
+static usize num_acquires, num_misses;
+
+static Block *counting_acquire(usize block_no) {
+    usize read_count = mock.read_count;
+    auto *b = cache_acquire(block_no);
+    num_acquires++;
+    if (mock.read_count != read_count)
+        num_misses++;
+    return b;
+}
+
+static std::vector<BlockTraceRecord> load(const char *path, SuperBlock &sb) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw Internal("cannot open the trace");
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<BlockTraceRecord> records;
+    usize num_dropped = 0;
+    for (usize i = 0; i < data.size();) {
+        BlockTraceHeader header;
+        if (data.size() - i < sizeof(header))
+            throw Internal("truncated trace");
+        std::copy_n(&data[i], sizeof(header), reinterpret_cast<char *>(&header));
+        i += sizeof(header);
+        if (header.magic != BLOCK_TRACE_MAGIC)
+            throw Internal("bad trace magic");
+        if (records.empty())
+            sb = header.sblock;
+        num_dropped += header.num_dropped;
+
+        usize size = header.num_records * sizeof(BlockTraceRecord);
+        if (data.size() - i < size)
+            throw Internal("truncated trace");
+        usize n = records.size();
+        records.resize(n + header.num_records);
+        std::copy_n(&data[i], size, reinterpret_cast<char *>(&records[n]));
+        i += size;
+    }
+
+    if (num_dropped > 0)
+        printf("(warn) %llu records were dropped while tracing\n",
+               static_cast<unsigned long long>(num_dropped));
+    return records;
+}
+
+static void setup(const SuperBlock &sb) {
+    sblock = sb;
+    mock.initialize(sblock);
+
+    if (opts.read_us > 0) {
+        mock.on_read = [](usize, u8 *) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.read_us));
+        };
+    }
+    if (opts.write_us > 0) {
+        mock.on_write = [](usize, u8 *) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.write_us));
+        };
+    }
+
+    device.read = stub_read;
+    device.write = stub_write;
+    device.read_blocks = stub_read_blocks;
+    device.write_blocks = stub_write_blocks;
+    device.submit = stub_submit;
+
+    init_bcache(&sblock, &device);
+    cache_acquire = bcache.acquire;
+    bcache.acquire = counting_acquire;
+}
+
+void replay(const std::vector<BlockTraceRecord> &records) {
+    usize log_end = sblock.log_start + sblock.num_log_blocks;
+    usize traced_reads = 0, traced_writes = 0, num_skipped = 0;
+
+    OpContext ctx;
+    usize reserved = 0;
+    std::set<usize> synced;
+    auto end_op = [&] {
+        if (reserved > 0)
+            bcache.end_op(&ctx);
+        reserved = 0;
+        synced.clear();
+    };
+
+    auto begin = Clock::now();
+    for (const auto &r : records) {
+        if (r.op == BLOCK_TRACE_READ)
+            traced_reads += r.count;
+        else
+            traced_writes += r.count;
+
+        if (opts.timed) {
+            auto offset = std::chrono::nanoseconds(r.timestamp - records.front().timestamp);
+            std::this_thread::sleep_until(begin + offset);
+        }
+
+        if (r.block_no + r.count > sblock.num_blocks) {
+            num_skipped++;
+            continue;
+        }
+        if (r.block_no >= sblock.log_start && r.block_no < log_end) {
+            if (r.op == BLOCK_TRACE_WRITE && r.block_no == sblock.log_start)
+                end_op();
+            continue;
+        }
+
+        for (usize block_no = r.block_no; block_no < r.block_no + r.count; block_no++) {
+            if (r.op == BLOCK_TRACE_WRITE && !synced.count(block_no)) {
+                // unlogged writes of the trace may not fit in the log
+                // together with the logged ones.
+                if (synced.size() == reserved)
+                    end_op();
+                if (reserved == 0)
+                    reserved = bcache.begin_large_op(&ctx, sblock.num_log_blocks - 1);
+                synced.insert(block_no);
+            }
+
+            auto *b = bcache.acquire(block_no);
+            if (r.op == BLOCK_TRACE_WRITE)
+                bcache.sync(&ctx, b);
+            bcache.release(b);
+        }
+    }
+    end_op();
+
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+    usize total = num_acquires;
+    printf("(info) %llu records (%llu skipped) in %.0f us, %.1f records/s\n",
+           static_cast<unsigned long long>(records.size()),
+           static_cast<unsigned long long>(num_skipped),
+           us,
+           us > 0 ? records.size() * 1e6 / us : 0.0);
+    printf("(info) traced: %llu reads %llu writes | replayed: %llu reads %llu writes"
+           " | hit %.1f%%\n",
+           static_cast<unsigned long long>(traced_reads),
+           static_cast<unsigned long long>(traced_writes),
+           static_cast<unsigned long long>(mock.read_count),
+           static_cast<unsigned long long>(mock.write_count),
+           total == 0 ? 0.0 : 100.0 * (total - num_misses) / total);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    int c;
+    while ((c = getopt(argc, argv, "r:w:t")) != -1) {
+        switch (c) {
+            case 'r': opts.read_us = std::stoull(optarg); break;
+            case 'w': opts.write_us = std::stoull(optarg); break;
+            case 't': opts.timed = true; break;
+            default: optind = argc;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "usage: %s [-r read_us] [-w write_us] [-t] trace\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        SuperBlock sb;
+        auto records = load(argv[optind], sb);
+        if (records.empty()) {
+            printf("(info) the trace is empty\n");
+            return 0;
+        }
+        setup(sb);
+        replay(records);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "(error) %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -2,5 +2,6 @@
 #include <common/defines.h>
 #include <fs/inode.h>
 void console_intr();
+void console_output(const char *buf, isize n);
 isize console_write(Inode *ip, char *buf, isize n);
 isize console_read(Inode *ip, char *dst, isize n);
\ No newline at end of file
@@ -9,8 +9,6 @@
 struct container root_container;
 extern struct proc root_proc;
 
-void activate_group(struct container* group);
-
 void set_container_to_this(struct proc* proc)
 {
     proc->container = thisproc()->container;
@@ -21,8 +19,11 @@ void init_container(struct container* container)
     memset(container, 0, sizeof(struct container));
     container->parent = NULL;
     container->rootproc = NULL;
-    init_schinfo(&container->schinfo, true);
-    init_schqueue(&container->schqueue);
+    for (int i = 0; i < NCPU; i++) {
+        init_schinfo(&container->schinfo[i], true);
+        container->schinfo[i].cpu = i;
+        init_schqueue(&container->schqueue[i]);
+    }
     // TODO: initialize namespace (local pid allocator)
     memset(container->pidmap.bitmap, 0, MAX_CONTAINER_PID / 8);
     container->pidmap.last_pid = -1;
@@ -39,8 +40,8 @@ struct container* create_container(void (*root_entry)(), u64 arg)
     set_parent_to_this(container->rootproc);
     container->rootproc->container = container;
     
+    // the group is queued on a cpu along with its first runnable proc.
     start_proc(container->rootproc, root_entry, arg);
-    activate_group(container);
     return container;
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <kernel/cpu.h>
 #include <kernel/proc.h>
 #include <kernel/schinfo.h>
 #include <common/bitmap.h>
@@ -18,8 +19,8 @@ struct container
     struct container* parent;
     struct proc* rootproc;
 
-    struct schinfo schinfo;
-    struct schqueue schqueue;
+    struct schinfo schinfo[NCPU];
+    struct schqueue schqueue[NCPU];
 
     // TODO: namespace (local pid?)
     pidmap_t pidmap;
@@ -2,6 +2,7 @@
 #include <kernel/printk.h>
 #include <kernel/init.h>
 #include <kernel/sched.h>
+#include <kernel/vdso.h>
 #include <test/test.h>
 #include <driver/sd.h>
 
@@ -31,6 +32,9 @@ void kernel_entry() {
     // user_proc_test();
     // container_test();
     // sd_test();
+    // file_bench();
+    // sched_bench();
+    // timer_bench();
     
     do_rest_init();
     // pgfault_first_test();
@@ -41,6 +45,7 @@ void kernel_entry() {
     for(u64 ka = PAGE_BASE((u64)icode), va = 0x0; ka <= (u64)eicode; va += PAGE_SIZE, ka += PAGE_SIZE){
         vmmap(&p->pgdir, va, (void*)ka, PTE_USER_DATA | PTE_RO);
     }
+    map_vdso(&p->pgdir);
     p->cwd = inodes.root;
     p->ucontext->elr = (u64)icode - PAGE_BASE((u64)icode);
     set_return_addr(trap_return);
@@ -2,9 +2,11 @@
 #include <kernel/printk.h>
 #include <kernel/init.h>
 #include <driver/clock.h>
+#include <driver/interrupt.h>
 #include <kernel/sched.h>
 #include <kernel/proc.h>
 #include <aarch64/mmu.h>
+#include <common/sem.h>
 
 struct cpu cpus[NCPU];
 
@@ -18,64 +20,133 @@ static bool __timer_cmp(rb_node lnode, rb_node rnode)
     return false;
 }
 
+// `next_timer` caches the first timer of the tree, so that the clock is
+// only reprogrammed when it changes.
 static void __timer_set_clock()
 {
-    auto node = _rb_first(&cpus[cpuid()].timer);
-    if (!node)
+    auto c = &cpus[cpuid()];
+    if (!c->next_timer)
     {
-        reset_clock(1000);
+        // no timer, no interrupt: an idle cpu sleeps until an IPI.
+        reset_clock_at(~0ull);
         return;
     }
-    auto t1 = container_of(node, struct timer, _node)->_key;
-    auto t0 = get_timestamp_ms();
-    if (t1 <= t0)
-        reset_clock(0);
-    else
-        reset_clock(t1 - t0);
+    reset_clock_at(c->next_timer->_key);
+}
+
+static void __timer_insert(struct timer* timer)
+{
+    auto c = &cpus[cpuid()];
+    timer->triggered = false;
+    timer->_cpu = cpuid();
+    timer->_key = MIN(timer->_key, TIMER_KEY_MAX);
+    _acquire_spinlock(&c->timer_lock);
+    ASSERT(0 == _rb_insert(&timer->_node, &c->timer, __timer_cmp));
+    bool first = !c->next_timer || __timer_cmp(&timer->_node, &c->next_timer->_node);
+    if (first)
+    {
+        c->next_timer = timer;
+        __timer_set_clock();
+    }
+    _release_spinlock(&c->timer_lock);
+}
+
+// with the timer lock of the cpu held.
+static void __timer_erase(struct cpu* c, struct timer* timer)
+{
+    _rb_erase(&timer->_node, &c->timer);
+    if (c->next_timer == timer)
+    {
+        auto node = _rb_first(&c->timer);
+        c->next_timer = node ? container_of(node, struct timer, _node) : NULL;
+        // a timer cancelled from another cpu leaves its clock to fire
+        // early, and `timer_clock_handler` reprograms it.
+        if (c == &cpus[cpuid()])
+            __timer_set_clock();
+    }
 }
 
 static void timer_clock_handler() {
-    reset_clock(1000);
+    auto c = &cpus[cpuid()];
+    c->timer_irqs++;
+    if (thisproc()->idle)
+        c->idle_timer_irqs++;
     // printk("cpu %d aha\n", cpuid());
     while (1)
     {
-        auto node = _rb_first(&cpus[cpuid()].timer);
-        if (!node)
-            break;
-        auto timer = container_of(node, struct timer, _node);
-        if (get_timestamp_ms() < timer->_key)
+        // the handler may switch procs, and this one resume on another cpu.
+        c = &cpus[cpuid()];
+        _acquire_spinlock(&c->timer_lock);
+        __timer_set_clock();
+        auto timer = c->next_timer;
+        if (!timer || get_timestamp() < timer->_key)
+        {
+            _release_spinlock(&c->timer_lock);
             break;
-        cancel_cpu_timer(timer);
+        }
+        __timer_erase(c, timer);
         timer->triggered = true;
+        _release_spinlock(&c->timer_lock);
         timer->handler(timer);
     }
 }
 
 define_early_init(clock_handler) {
+    for (int i = 0; i < NCPU; i++)
+        init_spinlock(&cpus[i].timer_lock);
     set_clock_handler(&timer_clock_handler);
 }
 
 void set_cpu_timer(struct timer* timer)
 {
-    timer->triggered = false;
-    timer->_key = get_timestamp_ms() + timer->elapse;
-    ASSERT(0 == _rb_insert(&timer->_node, &cpus[cpuid()].timer, __timer_cmp));
-    __timer_set_clock();
+    timer->_key = get_timestamp() + ns_to_timestamp(timer->elapse * 1000000ull + timer->elapse_ns);
+    __timer_insert(timer);
+}
+
+bool _cancel_cpu_timer(struct timer* timer)
+{
+    auto c = &cpus[timer->_cpu];
+    _acquire_spinlock(&c->timer_lock);
+    bool pending = !timer->triggered;
+    if (pending)
+        __timer_erase(c, timer);
+    _release_spinlock(&c->timer_lock);
+    return pending;
 }
 
 void cancel_cpu_timer(struct timer* timer)
 {
-    ASSERT(!timer->triggered);
-    _rb_erase(&timer->_node, &cpus[cpuid()].timer);
-    __timer_set_clock();
+    ASSERT(_cancel_cpu_timer(timer));
+}
+
+struct sleep_timer {
+    struct timer timer;
+    Semaphore sem;
+};
+
+static void sleep_timer_handler(struct timer* t)
+{
+    post_sem(&container_of(t, struct sleep_timer, timer)->sem);
 }
 
-static struct timer hello_timer[4];
-static void hello(struct timer* t)
+bool sleep_until(u64 timestamp)
 {
-    // printk("CPU %d: living\n", cpuid());
-    t->data++;
-    set_cpu_timer(&hello_timer[cpuid()]);
+    struct sleep_timer s;
+    init_sem(&s.sem, 0);
+    s.timer.handler = sleep_timer_handler;
+    s.timer._key = timestamp;
+    __timer_insert(&s.timer);
+    if (wait_sem(&s.sem))
+        return true;
+    if (_cancel_cpu_timer(&s.timer))
+        return false;
+    // the timer fired meanwhile: its handler still uses `s` until it posts.
+    unalertable_wait_sem(&s.sem);
+    return false;
+}
+
+int get_cpu_id() {
+    return cpuid();
 }
 
 void set_cpu_on() {
@@ -87,16 +158,15 @@ void set_cpu_on() {
     arch_set_vbar(exception_vector);
     arch_reset_esr();
     init_clock();
+    init_ipi();
     cpus[cpuid()].online = true;
     printk("CPU %d: hello\n", cpuid());
-    hello_timer[cpuid()].elapse = 5000;
-    hello_timer[cpuid()].handler = hello;
-    set_cpu_timer(&hello_timer[cpuid()]);
 }
 
 void set_cpu_off() {
     auto t = _arch_disable_trap();
     (void)t;
     cpus[cpuid()].online = false;
-    printk("CPU %d: stopped\n", cpuid());
+    printk("CPU %d: stopped, %llu timer interrupts, %llu while idle\n",
+           cpuid(), cpus[cpuid()].timer_irqs, cpus[cpuid()].idle_timer_irqs);
 }
@@ -5,11 +5,17 @@
 
 #define NCPU 4
 
+// timer keys are compared by their signed difference, which only holds
+// while they stay below 2^63. later deadlines are clamped to it.
+#define TIMER_KEY_MAX (~0ull >> 1)
+
 struct timer
 {
     bool triggered;
-    int elapse;
-    u64 _key;
+    int elapse;      // in ms.
+    u64 elapse_ns;   // added to `elapse`, for timers finer than 1 ms.
+    u64 _key;        // the deadline, in ticks of `get_timestamp`, at most TIMER_KEY_MAX.
+    int _cpu;        // whose tree holds it.
     struct rb_node_ _node;
     void (*handler)(struct timer*);
     u64 data;
@@ -18,14 +24,27 @@ struct timer
 struct cpu
 {
     bool online;
+    SpinLock timer_lock;  // protects `timer`, so that other cpus can cancel.
     struct rb_root_ timer;
+    struct timer* next_timer;  // the first of `timer`.
     struct sched sched;
+    u64 timer_irqs;       // timer interrupts taken.
+    u64 idle_timer_irqs;  // of them, taken while idle.
 };
 
 extern struct cpu cpus[NCPU];
 
+// `cpuid` for code that is also built for the host, see `fs/test`.
+WARN_RESULT int get_cpu_id();
+
 void set_cpu_on();
 void set_cpu_off();
 
 void set_cpu_timer(struct timer* timer);
 void cancel_cpu_timer(struct timer* timer);
+// return false if the timer has fired.
+WARN_RESULT bool _cancel_cpu_timer(struct timer* timer);
+
+// sleep until `get_timestamp` reaches `timestamp`. return false if woken
+// up early, e.g. by `kill`.
+WARN_RESULT bool sleep_until(u64 timestamp);
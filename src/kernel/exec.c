@@ -8,11 +8,13 @@
 #include <kernel/pt.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
+#include <kernel/vdso.h>
 #include <aarch64/trap.h>
 #include <fs/file.h>
 #include <fs/inode.h>
 
-//static u64 auxv[][2] = {{AT_PAGESZ, PAGE_SIZE}};
+// above envp on the new stack. AT_SYSINFO_EHDR is where libc finds the vDSO.
+static u64 auxv[][2] = {{AT_SYSINFO_EHDR, VDSO_TEXT}, {AT_PAGESZ, PAGE_SIZE}, {AT_NULL, 0}};
 extern int fdalloc(struct file* f);
 
 static int error(OpContext* ctx, Inode* inode, struct pgdir* pd){
@@ -89,7 +91,6 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		s->end = s->begin + phdr.p_memsz;
 		_insert_into_list(&pd.section_head, &s->stnode);
 		s->fp = filealloc();
-		memset(s->fp, 0, sizeof(struct file));
 		s->fp->ip = inode;
 		s->fp->type = FD_INODE;
 		s->fp->readable = true;
@@ -114,6 +115,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 	inodes.unlock(inode);
 	inodes.put(&ctx, inode);
 	bcache.end_op(&ctx);
+	map_vdso(&pd);
 	// Step3
 	sp = PAGE_BASE(sp+PAGE_SIZE-1);
 	struct section* s = kalloc(sizeof(struct section));
@@ -150,6 +152,8 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 	}
 	
 	sp -= sp%8;
+	sp -= sizeof(auxv);
+	copyout(&pd, (void*)sp, auxv, sizeof(auxv));
 	for(int i = envc; i >= 0; i--){
 		sp -= sizeof(char*);
 		copyout(&pd, (void*)sp, &envpp[i], sizeof(char*));
@@ -17,7 +17,12 @@ static QueueNode* pages;
 extern char end[];
 define_early_init(pages)
 {
+    // a RAM disk image keeps its memory, see `ramdisk_size`.
+    u64 ramdisk_begin = P2K(RAMDISK_BASE);
+    u64 ramdisk_end = ramdisk_begin + round_up(ramdisk_size(), PAGE_SIZE);
     for (u64 p = PAGE_BASE((u64)&end) + PAGE_SIZE; p < P2K(PHYSTOP); p += PAGE_SIZE){
+        if (p >= ramdisk_begin && p < ramdisk_end)
+            continue;
 	   add_to_queue(&pages, (QueueNode*)p); 
         _increment_rc(&alloc_page_cnt);
     }
@@ -33,10 +38,13 @@ define_init(zero_page){
 static QueueNode* slab[PAGE_SIZE/N];
 static struct page page_ref[PHYSTOP/PAGE_SIZE];
 
+// return NULL if memory runs out.
 void* kalloc_page()
 {
-    _decrement_rc(&alloc_page_cnt);
     auto p = fetch_from_queue(&pages);
+    if (p == NULL)
+        return NULL;
+    _decrement_rc(&alloc_page_cnt);
     auto page = &page_ref[K2P(p) / PAGE_SIZE];
     page->ref = 0;
     init_spinlock(&page->lock);
@@ -101,24 +109,17 @@ bool check_zero_page(){
     return true;
 }
 
+// swap blocks never go through the block cache: a page is one block, moved
+// straight between the device and the page in a single command.
 u32 write_page_to_disk(void* ka){
-    u32 bno = find_and_set_8_blocks();
-    for(u32 i = 0; i < 8; i++){
-        Block* b = bcache.acquire(bno + i);
-        memcpy(b->data, ka + i * BLOCK_SIZE, BLOCK_SIZE);
-        bcache.sync(NULL, b);
-        bcache.release(b);
-    }
+    u32 bno = find_and_set_swap_block();
+    block_device.write_blocks(bno, 1, ka);
     return bno;
 }
 
 void read_page_from_disk(void* ka, u32 bno){
-    for(u32 i = 0; i < 8; i++){
-        Block* b = bcache.acquire(bno + i);
-        memcpy(ka + i * BLOCK_SIZE, b->data, BLOCK_SIZE);
-        bcache.release(b);
-    }
-    release_8_blocks(bno);
+    block_device.read_blocks(bno, 1, ka);
+    release_swap_block(bno);
 }
 
 void increment_ref(void* ka){
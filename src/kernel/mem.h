@@ -2,8 +2,8 @@
 
 #include <common/defines.h>
 #include <aarch64/mmu.h>
-#include <common/rc.h>
-#include <common/ipc.h>
+#include <common/rc.h>
+#include <common/spinlock.h>
 
 #define REVERSED_PAGES 1024 //Reversed pages
 
@@ -114,7 +114,7 @@ void swapout(struct pgdir* pd, struct section* st){
 	}
 	release_sleeplock(out, &st->sleeplock);
 }
-//Free 8 continuous disk blocks
+//Free the swap block of each page
 void swapin(struct pgdir* pd, struct section* st){
 	ASSERT(st->flags & ST_SWAP);
 	//TODO
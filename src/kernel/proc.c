@@ -6,6 +6,7 @@
 #include <common/string.h>
 #include <kernel/printk.h>
 #include <kernel/paging.h>
+#include <kernel/vdso.h>
 
 struct proc root_proc;
 extern struct container root_container;
@@ -111,10 +112,7 @@ NO_RETURN void exit(int code)
     ASSERT(this != this->container->rootproc && !this->idle);
     this->exitcode = code;
     free_pgdir(&this->pgdir);
-    for(int i = 0; i < NOFILE; i++){
-        if(this->oftable.fp[i] != NULL)
-            fileclose(this->oftable.fp[i]);
-    }
+    close_oftable(&this->oftable);
     struct proc* rootproc = this->container->rootproc;
     _acquire_spinlock(&tree_lock);
     ListNode* pre = NULL;
@@ -191,7 +189,10 @@ int kill(int pid)
     auto p = _hashmap_lookup(&(hashpid_t){pid, NULL, {NULL}}.node, &h, hash, hashcmp);
     if(p != NULL){
         auto proc = container_of(p, hashpid_t, node)->proc;
-        if(is_unused(proc)) return -1;
+        if(is_unused(proc)){
+            _release_spinlock(&tree_lock);
+            return -1;
+        }
         proc->killed = true;
         alert_proc(proc);
         _release_spinlock(&tree_lock);
@@ -201,6 +202,59 @@ int kill(int pid)
     return -1;
 }
 
+// the proc of `localpid` in the subtree of `p`, without the subtrees of
+// nested containers, whose pids are their own. with the tree locked.
+static struct proc* find_proc(struct proc* p, int localpid)
+{
+    if(p->localpid == localpid && !is_zombie(p))
+        return p;
+    _for_in_list(node, &p->children){
+        if(node == &p->children) continue;
+        auto child = container_of(node, struct proc, ptnode);
+        if(child == child->container->rootproc) continue;
+        auto r = find_proc(child, localpid);
+        if(r != NULL) return r;
+    }
+    return NULL;
+}
+
+// set the prio of the proc of `localpid` in the container of this proc, or
+// of this proc if `localpid` is 0. return -1 if there is no such proc.
+int set_priority(int localpid, int prio)
+{
+    _acquire_spinlock(&tree_lock);
+    auto this = thisproc();
+    auto p = localpid == 0 ? this : find_proc(this->container->rootproc, localpid);
+    if(p != NULL)
+        set_proc_prio(p, prio);
+    _release_spinlock(&tree_lock);
+    return p != NULL ? 0 : -1;
+}
+
+// the prio of the proc of `localpid`, like `set_priority`, or -1.
+int get_priority(int localpid)
+{
+    _acquire_spinlock(&tree_lock);
+    auto this = thisproc();
+    auto p = localpid == 0 ? this : find_proc(this->container->rootproc, localpid);
+    int prio = p != NULL ? p->schinfo.prio : -1;
+    _release_spinlock(&tree_lock);
+    return prio;
+}
+
+// kill the proc of `localpid` in the container of this proc, like `kill`.
+int kill_local(int localpid)
+{
+    _acquire_spinlock(&tree_lock);
+    auto p = find_proc(thisproc()->container->rootproc, localpid);
+    if(p != NULL){
+        p->killed = true;
+        alert_proc(p);
+    }
+    _release_spinlock(&tree_lock);
+    return p != NULL ? 0 : -1;
+}
+
 int start_proc(struct proc* p, void(*entry)(u64), u64 arg)
 {
     // TODO
@@ -242,6 +296,7 @@ void init_proc(struct proc* p)
     p->parent = NULL;
     init_schinfo(&(p->schinfo), 0);
     init_pgdir(&p->pgdir);
+    init_oftable(&p->oftable);
     p->container = &root_container;
     p->kstack = kalloc_page();
     memset(p->kstack, 0, PAGE_SIZE);
@@ -320,16 +375,16 @@ int fork() {
             }
         }
     }
+    map_vdso(&np->pgdir);
     arch_tlbi_vmalle1is();
 
     memcpy(np->kstack, p->kstack, PAGE_SIZE);
     *np->ucontext = *p->ucontext;
     np->ucontext->x[0] = 0;
 
-    for(int i=0; i<NOFILE; i++){
-        if(p->oftable.fp[i])
-            np->oftable.fp[i] = filedup(p->oftable.fp[i]);
-    }
+    np->schinfo.prio = p->schinfo.prio;
+    np->schinfo.weight = p->schinfo.weight;
+    dup_oftable(&np->oftable, &p->oftable);
     np->cwd = inodes.share(p->cwd);
     set_parent_to_this(np);
     start_proc(np, trap_return, 0);
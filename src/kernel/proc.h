@@ -59,4 +59,7 @@ NO_RETURN void exit(int code);
 WARN_RESULT int wait(int* exitcode, int* pid);
 WARN_RESULT int kill(int pid);
 WARN_RESULT int fork();
+int set_priority(int localpid, int prio);
+WARN_RESULT int get_priority(int localpid);
+WARN_RESULT int kill_local(int localpid);
 struct proc* get_offline_proc();
@@ -5,22 +5,32 @@
 #include <kernel/printk.h>
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
+#include <kernel/container.h>
 #include <driver/clock.h>
+#include <driver/interrupt.h>
 #include <common/string.h>
 
 extern bool panic_flag;
 
 extern void swtch(KernelContext* new_ctx, KernelContext** old_ctx);
 
-static SpinLock schelock;
 extern struct container root_container;
 
+// every cpu schedules the procs on its own run queues, i.e. `schqueue[cpu]`
+// of every container, under its own `sched.lock`. procs move between cpus
+// only while they wait in a run queue, see `balance`.
+
+// how often, in ms, a busy cpu looks for a more loaded one to pull from.
+#define BALANCE_INTERVAL 20
+
+// when the running proc of every cpu is switched to, in ns.
 static u64 starttime[NCPU];
 static struct timer clock_interupt[NCPU];
 
-define_early_init(schelock)
+define_early_init(sched_lock)
 {
-    init_spinlock(&schelock);
+    for(int i=0; i<NCPU; i++)
+        init_spinlock(&cpus[i].sched.lock);
 }
 
 define_init(sched)
@@ -36,17 +46,12 @@ define_init(sched)
         starttime[i] = 0;
         p->schinfo.prio = 39;
         p->schinfo.weight = prio_to_weight[39];
+        p->schinfo.cpu = i;
         p->container = &root_container;
         p->pgdir.pt = (PTEntriesPtr)arch_get_ttbr0();
     }
 }
 
-inline static u64 min_vruntime(rb_root root){
-    auto t = _rb_first(root);
-    if(t == NULL) return thisproc()->schinfo.vruntime;
-    return container_of(t, struct schinfo, node)->vruntime;
-}
-
 bool cmp(rb_node lnode,rb_node rnode){
     auto l = container_of(lnode, struct schinfo, node);
     auto r = container_of(rnode, struct schinfo, node);
@@ -54,6 +59,10 @@ bool cmp(rb_node lnode,rb_node rnode){
     else return l->vruntime < r->vruntime;
 }
 
+// the container of a group entity, which is its `schinfo[cpu]`.
+static INLINE struct container* group_of(struct schinfo* s){
+    return container_of(s - s->cpu, struct container, schinfo[0]);
+}
 
 struct proc* thisproc()
 {
@@ -65,87 +74,211 @@ void init_schinfo(struct schinfo* p, bool group)
 {
     // TODO: initialize your customized schinfo for every newly-created process
     p->vruntime = 0;
-    p->prio = 21;
+    p->sum_runtime = 0;
+    p->prio = NICE_0_PRIO;
     p->weight = prio_to_weight[p->prio];
     p->iscontainer = group;
+    p->on_rq = false;
+    // a new proc starts on the cpu that creates it.
+    p->cpu = cpuid();
 }
 
 void init_schqueue(struct schqueue* s)
 {
     s->root.rb_node = NULL;
     s->weight_sum = 0;
-    s->Running = false;
-    s->sched_latency = 6;
+    s->nr_running = 0;
+    s->sched_latency = 6000000;
+    s->min_vruntime = 0;
+    s->curr = NULL;
 }
 
 void _acquire_sched_lock()
 {
     // TODO: acquire the sched_lock if need
-    _acquire_spinlock(&schelock);
+    _acquire_spinlock(&cpus[cpuid()].sched.lock);
 }
 
 void _release_sched_lock()
 {
     // TODO: release the sched_lock if need
-    _release_spinlock(&schelock);
+    _release_spinlock(&cpus[cpuid()].sched.lock);
+}
+
+// lock the run queues of the cpu `p` is on, and return the cpu. `p` may be
+// moved to another cpu until the lock is held.
+static int lock_sched_of(struct proc* p)
+{
+    while(1){
+        int c = *(volatile int*)&p->schinfo.cpu;
+        _acquire_spinlock(&cpus[c].sched.lock);
+        if(p->schinfo.cpu == c)
+            return c;
+        _release_spinlock(&cpus[c].sched.lock);
+    }
 }
 
 bool is_zombie(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    int c = lock_sched_of(p);
     r = p->state == ZOMBIE;
-    _release_sched_lock();
+    _release_spinlock(&cpus[c].sched.lock);
     return r;
 }
 
 bool is_unused(struct proc* p)
 {
     bool r;
-    _acquire_sched_lock();
+    int c = lock_sched_of(p);
     r = p->state == UNUSED;
-    _release_sched_lock();
+    _release_spinlock(&cpus[c].sched.lock);
     return r;
 }
 
+// queue `p` on cpu `c`, `lag` behind the minimum vruntime of its queue.
+// the entities of its containers are queued as well, up to the first one
+// that already is.
+static void enqueue_proc(struct proc* p, int c, u64 lag)
+{
+    auto se = &p->schinfo;
+    auto container = p->container;
+    se->cpu = c;
+    while(1){
+        auto q = &container->schqueue[c];
+        bool was_idle = q->nr_running == 0;
+        se->vruntime = q->min_vruntime + lag;
+        se->on_rq = true;
+        q->nr_running++;
+        q->weight_sum += se->weight;
+        ASSERT(!_rb_insert(&se->node, &q->root, cmp));
+        if(!was_idle || container == &root_container)
+            break;
+        se = &container->schinfo[c];
+        container = container->parent;
+        lag = 0;
+    }
+    cpus[c].sched.nr_running++;
+    cpus[c].sched.load += p->schinfo.weight;
+}
+
+// take `p`, which waits in the run queues of cpu `c`, off them, along with
+// the entities of its containers that have nothing else to run on `c`.
+static void dequeue_proc(struct proc* p, int c)
+{
+    auto se = &p->schinfo;
+    auto container = p->container;
+    while(1){
+        auto q = &container->schqueue[c];
+        _rb_erase(&se->node, &q->root);
+        se->on_rq = false;
+        q->nr_running--;
+        q->weight_sum -= se->weight;
+        if(q->nr_running > 0 || container == &root_container)
+            break;
+        se = &container->schinfo[c];
+        container = container->parent;
+    }
+    cpus[c].sched.nr_running--;
+    cpus[c].sched.load -= p->schinfo.weight;
+}
+
+// charge `delta` ns that `p` has run on cpu `c` to it and to the entities
+// of its containers there, each at its own weight.
+static void charge_runtime(struct proc* p, int c, u64 delta)
+{
+    p->schinfo.sum_runtime += delta;
+    auto se = &p->schinfo;
+    auto container = p->container;
+    while(1){
+        se->vruntime += delta*prio_to_weight[NICE_0_PRIO]/se->weight;
+        if(container == &root_container)
+            break;
+        se = &container->schinfo[c];
+        container = container->parent;
+    }
+}
+
+// change the weight of `p`, whether it sleeps, waits in a run queue or
+// runs. its vruntime is kept, as the trees are ordered by vruntime only.
+void set_proc_prio(struct proc* p, int prio)
+{
+    int c = lock_sched_of(p);
+    auto se = &p->schinfo;
+    int weight = prio_to_weight[prio];
+    if(se->on_rq){
+        p->container->schqueue[c].weight_sum += weight - se->weight;
+        cpus[c].sched.load += weight - se->weight;
+    }
+    if(cpus[c].sched.thisproc == p){
+        // charge the slice so far at the old weight, so that
+        // `update_this_state` charges only the rest at the new one.
+        u64 now = get_timestamp_ns();
+        charge_runtime(p, c, now - starttime[c]);
+        starttime[c] = now;
+    }
+    se->prio = prio;
+    se->weight = weight;
+    _release_spinlock(&cpus[c].sched.lock);
+}
+
+// lock an idle cpu other than `c`, whose lock is held, and return it.
+// return `c` if none can be locked at once.
+static int lock_idle_cpu(int c)
+{
+    for(int i = 1; i < NCPU; i++){
+        int idle = (c + i) % NCPU;
+        if(!cpus[idle].online || cpus[idle].sched.nr_running != 0)
+            continue;
+        if(!_try_acquire_spinlock(&cpus[idle].sched.lock))
+            continue;
+        if(cpus[idle].sched.nr_running == 0)
+            return idle;
+        _release_spinlock(&cpus[idle].sched.lock);
+    }
+    return c;
+}
+
+// whether a woken proc should not wait for the next tick of the cpu
+// running `curr`: the cpu is idle, or `curr` is lighter.
+static bool should_preempt(struct proc* p, struct proc* curr)
+{
+    return curr->idle || p->schinfo.weight > curr->schinfo.weight;
+}
+
 bool _activate_proc(struct proc* p, bool onalert)
 {
     // TODO
     // if the proc->state is RUNNING/RUNNABLE, do nothing and return false
     // if the proc->state is SLEEPING/UNUSED, set the process state to RUNNABLE, add it to the sched queue, and return true
     // if the proc->state is DEEPSLEEING, do nothing if onalert or activate it if else, and return the corresponding value.
-    _acquire_sched_lock();
+    // a sleeping proc holds the lock of its cpu until it is switched out,
+    // so it is queued on the cpu it last ran on.
+    int c = lock_sched_of(p);
     if(p->state == RUNNING || p->state == RUNNABLE || p->state == ZOMBIE || (p->state == DEEPSLEEPING && onalert)){
-        _release_sched_lock();
+        // a proc running alone on another cpu has no tick to bring it back
+        // to the kernel, where it would see that it was alerted.
+        bool kick = onalert && p->state == RUNNING && c != cpuid();
+        _release_spinlock(&cpus[c].sched.lock);
+        if(kick)
+            resched_cpu(c);
         return false;
     }
     p->state = RUNNABLE;
-    p->schinfo.vruntime = min_vruntime(&p->container->schqueue.root);
-    p->container->schqueue.weight_sum += p->schinfo.weight;
-    ASSERT(!_rb_insert(&p->schinfo.node, &p->container->schqueue.root, cmp));
-    if(p->state == SLEEPING){
-        auto container = p->container;
-        while(!container->schqueue.Running && container != &root_container && !_rb_lookup(&container->schinfo.node, &container->parent->schqueue.root, cmp)){
-            container->schinfo.vruntime = min_vruntime(&container->parent->schqueue.root);
-            container->parent->schqueue.weight_sum += container->schinfo.weight;
-            ASSERT(!_rb_insert(&container->schinfo.node, &container->parent->schqueue.root, cmp));
-            container = container->parent;
-        }
-    }
-    _release_sched_lock();
+    // rather than wait behind others, move to an idle cpu if there is one.
+    int target = c;
+    if(cpus[c].sched.nr_running > 0)
+        target = lock_idle_cpu(c);
+    enqueue_proc(p, target, 0);
+    bool preempt = cpus[target].sched.tick_stopped || should_preempt(p, cpus[target].sched.thisproc);
+    if(target != c)
+        _release_spinlock(&cpus[target].sched.lock);
+    _release_spinlock(&cpus[c].sched.lock);
+    if(preempt)
+        resched_cpu(target);
     return true;
 }
 
-void activate_group(struct container* group)
-{
-    // TODO: add the schinfo node of the group to the schqueue of its parent
-    _acquire_sched_lock();
-    group->schinfo.vruntime = min_vruntime(&group->parent->schqueue.root);
-    group->parent->schqueue.weight_sum += group->schinfo.weight;
-    ASSERT(!_rb_insert(&group->schinfo.node, &group->parent->schqueue.root, cmp));
-    _release_sched_lock();
-}
-
 static void update_this_state(enum procstate new_state)
 {
     // TODO: if using simple_sched, you should implement this routinue
@@ -153,27 +286,101 @@ static void update_this_state(enum procstate new_state)
     auto p = thisproc();
     p->state = new_state;
     if(p->idle) return;
-    u64 vruntime = (get_timestamp_ms() - starttime[cpuid()])*prio_to_weight[21]/p->schinfo.weight;
-    p->schinfo.vruntime += vruntime;
+    int c = cpuid();
+    charge_runtime(p, c, get_timestamp_ns() - starttime[c]);
+    bool runnable = new_state == RUNNABLE;
+    if(!runnable){
+        cpus[c].sched.nr_running--;
+        cpus[c].sched.load -= p->schinfo.weight;
+    }
+    // the proc and the entities of its containers are the running ones of
+    // their queues. they go back to the trees, unless they have nothing
+    // left to run.
+    auto se = &p->schinfo;
     auto container = p->container;
-    if(new_state == RUNNABLE){
-        ASSERT(!_rb_insert(&p->schinfo.node, &p->container->schqueue.root, cmp));
-        while(container != &root_container){
-            container->schinfo.vruntime += vruntime;
-            container->schqueue.Running = false;
-            ASSERT(!_rb_insert(&container->schinfo.node, &container->parent->schqueue.root, cmp));
-            container = container->parent;
+    while(1){
+        auto q = &container->schqueue[c];
+        q->curr = NULL;
+        if(runnable){
+            ASSERT(!_rb_insert(&se->node, &q->root, cmp));
+        }else{
+            se->on_rq = false;
+            q->nr_running--;
+            q->weight_sum -= se->weight;
+            runnable = q->nr_running > 0;
+        }
+        if(container == &root_container)
+            break;
+        se = &container->schinfo[c];
+        container = container->parent;
+    }
+}
+
+// move a proc waiting on cpu `from` to this cpu, if the run queues of
+// `from` can be locked at once and the next proc it would run there is
+// lighter than `max_weight`. return whether a proc is moved.
+static bool pull_from(int from, u64 max_weight)
+{
+    int c = cpuid();
+    if(!_try_acquire_spinlock(&cpus[from].sched.lock))
+        return false;
+    struct proc* p = NULL;
+    auto q = &root_container.schqueue[from];
+    auto node = _rb_first(&q->root);
+    while(node != NULL){
+        auto se = container_of(node, struct schinfo, node);
+        if(!se->iscontainer){
+            p = container_of(se, struct proc, schinfo);
+            break;
+        }
+        q = &group_of(se)->schqueue[from];
+        node = _rb_first(&q->root);
+    }
+    bool moved = p != NULL && (u64)p->schinfo.weight < max_weight;
+    if(moved){
+        u64 lag = p->schinfo.vruntime - MIN(p->schinfo.vruntime, q->min_vruntime);
+        dequeue_proc(p, from);
+        enqueue_proc(p, c, lag);
+    }
+    _release_spinlock(&cpus[from].sched.lock);
+    return moved;
+}
+
+// an idle cpu steals from any cpu with procs waiting. a busy one pulls
+// from the most loaded cpu every BALANCE_INTERVAL ms, if moving one proc
+// evens out their loads.
+// the locks of other cpus are only tried, as this cpu holds its own.
+// cpus without a tick do not balance by themselves, so a cpu with procs
+// waiting kicks them every BALANCE_INTERVAL ms as well.
+static void balance()
+{
+    int c = cpuid();
+    auto this = &cpus[c].sched;
+    if(this->nr_running == 0){
+        for(int i = 1; i < NCPU; i++){
+            int from = (c + i) % NCPU;
+            if(cpus[from].sched.nr_running > 1 && pull_from(from, (u64)-1))
+                return;
         }
-    }else{
-        p->container->schqueue.weight_sum -= p->schinfo.weight;
-        while(container != &root_container){
-            container->schinfo.vruntime += vruntime;
-            container->schqueue.Running = false;
-            if(_rb_first(&container->schqueue.root) != NULL){
-                ASSERT(!_rb_insert(&container->schinfo.node, &container->parent->schqueue.root, cmp));
-            }
-            container->parent->schqueue.weight_sum -= container->schinfo.weight;
-            container = container->parent;
+        return;
+    }
+    u64 now = get_timestamp_ms();
+    if(now - this->last_balance < BALANCE_INTERVAL)
+        return;
+    this->last_balance = now;
+    int busiest = c;
+    for(int i = 0; i < NCPU; i++){
+        if(cpus[i].sched.load > cpus[busiest].sched.load)
+            busiest = i;
+    }
+    // moving weight w leaves the loads |diff - 2w| apart, closer only if
+    // w < diff.
+    if(busiest != c && cpus[busiest].sched.nr_running > 1)
+        pull_from(busiest, cpus[busiest].sched.load - this->load);
+    if(this->nr_running > 1){
+        for(int i = 0; i < NCPU; i++){
+            if(i != c && cpus[i].online && cpus[i].sched.tick_stopped)
+                resched_cpu(i);
         }
     }
 }
@@ -182,23 +389,21 @@ static struct proc* pick_next()
 {
     // TODO: if using simple_sched, you should implement this routinue
     // choose the next process to run, and return idle if no runnable process
-    auto container = &root_container;
-    auto node = _rb_first(&container->schqueue.root);
-    if(node != NULL){
-        auto schinfo = container_of(node, struct schinfo, node);
-        while(schinfo->iscontainer){
-            container = container_of(schinfo, struct container, schinfo);
-            container->schqueue.Running = true;
-            container->schqueue.sched_latency = container->parent->schqueue.sched_latency * container->schinfo.weight / container->parent->schqueue.weight_sum;
-            _rb_erase(&container->schinfo.node, &container->parent->schqueue.root);
-            node = _rb_first(&container->schqueue.root);
-            schinfo = container_of(node, struct schinfo, node);
-        }
-        auto proc = container_of(schinfo, struct proc, schinfo);
-        _rb_erase(&proc->schinfo.node, &proc->container->schqueue.root);
-        return proc;
+    int c = cpuid();
+    auto q = &root_container.schqueue[c];
+    if(q->nr_running == 0)
+        return cpus[c].sched.idle;
+    while(1){
+        auto se = container_of(_rb_first(&q->root), struct schinfo, node);
+        _rb_erase(&se->node, &q->root);
+        q->curr = se;
+        q->min_vruntime = MAX(q->min_vruntime, se->vruntime);
+        if(!se->iscontainer)
+            return container_of(se, struct proc, schinfo);
+        auto group = &group_of(se)->schqueue[c];
+        group->sched_latency = (u64)q->sched_latency * se->weight / q->weight_sum;
+        q = group;
     }
-    return cpus[cpuid()].sched.idle;
 }
 
 void HandleClock(){
@@ -208,21 +413,49 @@ void HandleClock(){
     sched(qaq, RUNNABLE);
 }
 
+static void HandleResched(){
+    setup_checker(qaq);
+    lock_for_sched(qaq);
+    sched(qaq, RUNNABLE);
+}
+
+define_init(resched_ipi)
+{
+    set_ipi_handler(IPI_RESCHED, HandleResched);
+}
+
+// make `cpu` reschedule as soon as it takes interrupts, e.g. to leave
+// `arch_wfi` in `idle_entry`. this cpu can be one as well.
+void resched_cpu(int cpu)
+{
+    send_ipi(cpu, IPI_RESCHED);
+}
+
 static void update_this_proc(struct proc* p)
 {
     // TODO: if using simple_sched, you should implement this routinue
     // update thisproc to the choosen process, and reset the clock interrupt if need
-    while(clock_interupt[cpuid()].data){
-        clock_interupt[cpuid()].data--;
-        cancel_cpu_timer(&clock_interupt[cpuid()]);
+    int c = cpuid();
+    while(clock_interupt[c].data){
+        clock_interupt[c].data--;
+        cancel_cpu_timer(&clock_interupt[c]);
     }
-    clock_interupt[cpuid()].data++;
-    if(p->idle) clock_interupt[cpuid()].elapse = 1;
-    else clock_interupt[cpuid()].elapse = MAX(p->container->schqueue.sched_latency * p->schinfo.weight / p->container->schqueue.weight_sum, min_lantency);
-    clock_interupt[cpuid()].handler = HandleClock;
-    starttime[cpuid()] = get_timestamp_ms();
-    set_cpu_timer(&clock_interupt[cpuid()]);
-    cpus[cpuid()].sched.thisproc = p;
+    // no tick when there is nothing else to switch to: the idle proc waits
+    // for an IPI, and a lone proc runs until it sleeps or a wakeup on this
+    // cpu restarts the tick, see `_activate_proc`.
+    cpus[c].sched.tick_stopped = cpus[c].sched.nr_running <= 1;
+    if(!cpus[c].sched.tick_stopped){
+        // the slice is not rounded to ms, so that light procs in a crowded
+        // queue get their share as well.
+        auto q = &p->container->schqueue[c];
+        clock_interupt[c].data++;
+        clock_interupt[c].elapse = 0;
+        clock_interupt[c].elapse_ns = MAX((u64)q->sched_latency * p->schinfo.weight / q->weight_sum, min_lantency * 1000000ull);
+        clock_interupt[c].handler = HandleClock;
+        set_cpu_timer(&clock_interupt[c]);
+    }
+    starttime[c] = get_timestamp_ns();
+    cpus[c].sched.thisproc = p;
 }
 
 // A simple scheduler.
@@ -236,6 +469,7 @@ static void simple_sched(enum procstate new_state)
         return;
     }
     update_this_state(new_state);
+    balance();
     auto next = pick_next();
     update_this_proc(next);
     ASSERT(next->state == RUNNABLE);
@@ -245,6 +479,7 @@ static void simple_sched(enum procstate new_state)
         attach_pgdir(&next->pgdir);
         swtch(next->kcontext, &this->kcontext);
     }
+    // this proc may resume on another cpu, whose lock was taken there.
     _release_sched_lock();
 }
 
@@ -256,4 +491,3 @@ u64 proc_entry(void(*entry)(u64), u64 arg)
     set_return_addr(entry);
     return arg;
 }
-
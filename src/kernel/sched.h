@@ -12,6 +12,8 @@ bool _activate_proc(struct proc*, bool onalert);
 #define alert_proc(proc) _activate_proc(proc, true)
 WARN_RESULT bool is_zombie(struct proc*);
 WARN_RESULT bool is_unused(struct proc*);
+void resched_cpu(int cpu);
+void set_proc_prio(struct proc*, int prio);
 void _acquire_sched_lock();
 #define lock_for_sched(checker) (checker_begin_ctx(checker), _acquire_sched_lock())
 void _sched(enum procstate new_state);
@@ -2,6 +2,7 @@
 
 #include <common/list.h>
 #include <common/rbtree.h>
+#include <common/spinlock.h>
 
 // #define sched_latency 22
 #define min_lantency 1
@@ -14,19 +15,32 @@ struct sched
     // TODO: customize your sched info
     struct proc* thisproc;
     struct proc* idle;
+    // protects the run queues of this cpu, i.e. `schqueue[cpu]` of every
+    // container, and the state of the procs on them.
+    SpinLock lock;
+    int nr_running;    // runnable procs on this cpu, including the running one.
+    u64 load;          // sum of their weights.
+    u64 last_balance;  // see `balance` in `sched.c`.
+    bool tick_stopped; // no clock interrupt for the running proc.
 };
 
 // embeded data for procs
+// a container has one per cpu, as the entity of its run queue on that cpu.
 struct schinfo
 {
     // TODO: customize your sched info
-    u64 vruntime;
-    int prio;
+    u64 vruntime;     // in ns, weighted by prio_to_weight[NICE_0_PRIO] / weight.
+    u64 sum_runtime;  // the time it has run, in ns.
+    int prio;         // nice + NICE_0_PRIO, indexes prio_to_weight.
     int weight;
     struct rb_node_ node;
     bool iscontainer;
+    bool on_rq;  // runnable: either in the tree of its queue or running.
+    int cpu;     // the cpu whose run queues hold it.
 };
 
+#define NICE_0_PRIO 20
+
 static const int prio_to_weight[40]={
 /* -20 */ 88761, 71755, 56483, 46273, 36291,
 /* -15 */ 29154, 23254, 18705, 14949, 11916,
@@ -38,12 +52,14 @@ static const int prio_to_weight[40]={
 /* 15 */ 36, 29, 23, 18, 15
 };
 
-// embedded data for containers
+// embedded data for containers, one per cpu
 struct schqueue
 {
     // TODO: customize your sched queue
     struct rb_root_ root;
-    int weight_sum;
-    int sched_latency;
-    bool Running;
+    int weight_sum;   // of the runnable entities, including `curr`.
+    int nr_running;   // number of the runnable entities.
+    int sched_latency;  // in ns.
+    u64 min_vruntime;
+    struct schinfo* curr;  // the running entity, which is not in `root`.
 };
@@ -3,6 +3,8 @@
 
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_blktrace 501
+#define SYS_blkreplay 502
 #define SYS_sbrk 12
 
 #define SYS_clone 220
@@ -12,8 +14,19 @@
 #define SYS_ioctl 29
 #define SYS_sigprocmask 135
 #define SYS_wait4 260
+#define SYS_kill 129
+#define SYS_fsync 82
+#define SYS_fdatasync 83
 #define SYS_exit_group 94
 #define SYS_unlinkat 35
+#define SYS_nanosleep 101
+#define SYS_clock_settime 112
+#define SYS_clock_gettime 113
+#define SYS_clock_nanosleep 115
+#define SYS_setpriority 140
+#define SYS_getpriority 141
+#define SYS_sched_setattr 274
+#define SYS_sched_getattr 275
 
 #define SYS_exit 93
 #define SYS_exit_group 94
@@ -4,6 +4,7 @@
 // user code, and calls into file.c and fs.c.
 //
 
+#include <errno.h>
 #include <fcntl.h>
 
 #include <aarch64/mmu.h>
@@ -45,14 +46,7 @@ static struct file* fd2file(int fd) {
  */
 int fdalloc(struct file* f) {
     /* TODO: Lab10 Shell */
-    auto oftable = &thisproc()->oftable;
-    for(int i=0; i<NFILE; i++){
-        if(oftable->fp[i] == NULL){
-            oftable->fp[i] = f;
-            return i;
-        }
-    }
-    return -1;
+    return alloc_fd(&thisproc()->oftable, f);
 }
 
 define_syscall(ioctl, int fd, u64 request) {
@@ -105,6 +99,8 @@ define_syscall(munmap, void *addr, int length) {
 		}
     }
     if(!st) return -1;
+    // delayed data would not fit in the operation below.
+    fileflush(st->fp);
     OpContext ctx;
     bcache.begin_op(&ctx);
     inodes.write(&ctx, st->fp->ip, addr, st->offset + (u64)addr - st->begin, length);
@@ -143,6 +139,32 @@ define_syscall(dup, int fd) {
     return nfd;
 }
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#endif
+
+define_syscall(fcntl, int fd, int cmd, u64 arg) {
+    struct file* f = fd2file(fd);
+    if (!f)
+        return -1;
+    switch (cmd) {
+        case F_GETFD:
+        case F_SETFD:
+            return 0;
+        case F_SETPIPE_SZ:
+            if (f->type != FD_PIPE)
+                return -1;
+            return pipeResize(f->pipe, arg);
+        case F_GETPIPE_SZ:
+            if (f->type != FD_PIPE)
+                return -1;
+            return f->pipe->size;
+        default:
+            return -EINVAL;
+    }
+}
+
 /*
  * Get the parameters and call fileread.
  */
@@ -153,10 +175,13 @@ define_syscall(read, int fd, char* buffer, int size) {
     char* ka = alloc_page_for_user();
     int i = 0;
     while(i < size){
-        int t = fileread(f, ka, MIN(PAGE_SIZE, size - i));
-        memcpy(buffer + i, ka, MAX(t, 0));
+        int want = MIN(PAGE_SIZE, size - i);
+        int t = fileread(f, ka, want);
+        if(t <= 0) break;
+        memcpy(buffer + i, ka, t);
         i += t;
-        if(t != MIN(PAGE_SIZE, size - i)) break;
+        // a short read (e.g. a pipe with less data) ends the call.
+        if(t != want) break;
     }
     kfree_page(ka);
     return i;
@@ -169,14 +194,22 @@ define_syscall(write, int fd, char* buffer, int size) {
     struct file* f = fd2file(fd);
     if (!f || size <= 0 || !user_readable(buffer, size))
         return -1;
+    if (f->type == FD_INODE) {
+        // fault the buffer in before any lock is taken, then hand it over
+        // as a whole, so that filewrite can use a few large atomic operations.
+        for (int i = 0; i < size; i += PAGE_SIZE - (u64)(buffer + i) % PAGE_SIZE)
+            (void)*(volatile char*)(buffer + i);
+        return filewrite(f, buffer, size);
+    }
     char* ka = alloc_page_for_user();
     int i = 0;
     while(i < size){
-        int t = MIN(PAGE_SIZE, size - i);
-        memcpy(ka, buffer + i, t);
-        t = filewrite(f, ka, t);
+        int want = MIN(PAGE_SIZE, size - i);
+        memcpy(ka, buffer + i, want);
+        int t = filewrite(f, ka, want);
+        if(t <= 0) break;
         i += t;
-        if(t != MIN(PAGE_SIZE, size - i)) break;
+        if(t != want) break;
     }
     kfree_page(ka);
     return i;
@@ -206,19 +239,76 @@ define_syscall(writev, int fd, struct iovec *iov, int iovcnt) {
     return tot;
 }
 
+/*
+ * Send count bytes of in_fd, from *offset or the file offset, to out_fd.
+ */
+define_syscall(sendfile, int out_fd, int in_fd, isize* offset, usize count) {
+    struct file* out = fd2file(out_fd);
+    struct file* in = fd2file(in_fd);
+    if (!out || !in || (offset && !user_writeable(offset, sizeof(*offset))))
+        return -1;
+    if (offset && *offset < 0)
+        return -1;
+    usize* off = offset ? (usize*)offset : &in->off;
+    return filesend(out, in, off, MIN(count, (usize)0x7ffff000));
+}
+
+/*
+ * Move data between a file and a pipe. Only file to pipe, and pipe to file
+ * with the file offset, are supported.
+ */
+define_syscall(splice, int fd_in, isize* off_in, int fd_out, isize* off_out, usize len, int flags) {
+    struct file* in = fd2file(fd_in);
+    struct file* out = fd2file(fd_out);
+    (void)flags;
+    if (!in || !out || off_out || (in->type == FD_PIPE) == (out->type == FD_PIPE))
+        return -1;
+    len = MIN(len, (usize)0x7ffff000);
+    if (out->type == FD_PIPE) {
+        if (off_in && (!user_writeable(off_in, sizeof(*off_in)) || *off_in < 0))
+            return -1;
+        return filesend(out, in, off_in ? (usize*)off_in : &in->off, len);
+    }
+    if (off_in || !in->readable)
+        return -1;
+    // the pipe is drained through one kernel page.
+    char* ka = alloc_page_for_user();
+    int t = fileread(in, ka, MIN((usize)PAGE_SIZE, len));
+    if (t > 0)
+        t = filewrite(out, ka, t);
+    kfree_page(ka);
+    return t;
+}
+
 /*
  * Get the parameters and call fileclose.
  * Clear this fd of this process.
  */
 define_syscall(close, int fd) {
     /* TODO: Lab10 Shell */
-    if(fd >= NOFILE || fd < 0)
+    struct file* f = free_fd(&thisproc()->oftable, fd);
+    if (!f)
+        return -1;
+    fileclose(f);
+    return 0;
+}
+
+/*
+ * Give the data buffered for fd its blocks. Every other write is on disk
+ * already: `end_op` returns once the operation is checkpointed.
+ */
+define_syscall(fsync, int fd) {
+    struct file* f = fd2file(fd);
+    if (!f)
         return -1;
-    fileclose(fd2file(fd));
-    thisproc()->oftable.fp[fd] = NULL;
+    fileflush(f);
     return 0;
 }
 
+define_syscall(fdatasync, int fd) {
+    return sys_fsync(fd);
+}
+
 /*
  * Get the parameters and call filestat.
  */
@@ -232,9 +322,12 @@ define_syscall(fstat, int fd, struct stat* st) {
 define_syscall(newfstatat, int dirfd, const char* path, struct stat* st, int flags) {
     if (!user_strlen(path, 256) || !user_writeable(st, sizeof(*st)))
         return -1;
+    Inode* base = NULL;
     if (dirfd != AT_FDCWD) {
-        printk("sys_fstatat: dirfd unimplemented\n");
-        return -1;
+        struct file* f = fd2file(dirfd);
+        if (!f || f->type != FD_INODE)
+            return -1;
+        base = f->ip;
     }
     if (flags != 0) {
         printk("sys_fstatat: flags unimplemented\n");
@@ -244,7 +337,7 @@ define_syscall(newfstatat, int dirfd, const char* path, struct stat* st, int fla
     Inode* ip;
     OpContext ctx;
     bcache.begin_op(&ctx);
-    if ((ip = namei(path, &ctx)) == 0) {
+    if ((ip = nameiat(base, path, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
     }
@@ -257,6 +350,81 @@ define_syscall(newfstatat, int dirfd, const char* path, struct stat* st, int fla
     return 0;
 }
 
+struct linux_dirent64 {
+    u64 d_ino;
+    i64 d_off;
+    u16 d_reclen;
+    u8 d_type;
+    char d_name[];
+};
+
+#define DT_CHR 2
+#define DT_DIR 4
+#define DT_REG 8
+
+// with `dp` locked, so that `de` keeps its inode alive. "." and ".."
+// are not locked, as ".." is above `dp` in the lock order.
+static u8 dirent_type(Inode* dp, const DirEntry* de, OpContext* ctx) {
+    if (de->inode_no == dp->inode_no || strncmp(de->name, "..", FILE_NAME_MAX_LENGTH) == 0)
+        return DT_DIR;
+    Inode* ip = inodes.get(de->inode_no);
+    inodes.lock(ip);
+    InodeType type = ip->entry.type;
+    inodes.unlock(ip);
+    inodes.put(ctx, ip);
+    return type == INODE_DIRECTORY ? DT_DIR : type == INODE_DEVICE ? DT_CHR : DT_REG;
+}
+
+/*
+ * Fill `buf` with as many live entries of directory `fd` as fit in `count`
+ * bytes, starting at the file offset. Returns the number of bytes filled,
+ * 0 at the end of the directory.
+ */
+define_syscall(getdents64, int fd, void* buf, usize count) {
+    struct file* f = fd2file(fd);
+    if (!f || f->type != FD_INODE || !user_writeable(buf, count))
+        return -1;
+    Inode* dp = f->ip;
+    OpContext ctx;
+    bcache.begin_op(&ctx);
+    inodes.lock(dp);
+    if (dp->entry.type != INODE_DIRECTORY) {
+        inodes.unlock(dp);
+        bcache.end_op(&ctx);
+        return -1;
+    }
+    // take a page of raw entries, and resolve their types before unlocking:
+    // once the lock is dropped, an entry may be removed and its inode freed.
+    DirEntry* de = alloc_page_for_user();
+    usize n = inodes.read(dp, (u8*)de, f->off, PAGE_SIZE) / sizeof(DirEntry);
+    usize len = 0, i;
+    for (i = 0; i < n; i++) {
+        if (de[i].inode_no == 0)
+            continue;
+        usize namelen = 0;
+        while (namelen < FILE_NAME_MAX_LENGTH && de[i].name[namelen])
+            namelen++;
+        usize reclen = round_up(sizeof(struct linux_dirent64) + namelen + 1, 8);
+        if (len + reclen > count)
+            break;
+        struct linux_dirent64* d = (struct linux_dirent64*)((u8*)buf + len);
+        d->d_ino = de[i].inode_no;
+        d->d_off = f->off + (i + 1) * sizeof(DirEntry);
+        d->d_reclen = reclen;
+        d->d_type = dirent_type(dp, &de[i], &ctx);
+        memcpy(d->d_name, de[i].name, namelen);
+        d->d_name[namelen] = 0;
+        len += reclen;
+    }
+    inodes.unlock(dp);
+    bcache.end_op(&ctx);
+    kfree_page(de);
+    if (i < n && len == 0)
+        return -1;
+    f->off += i * sizeof(DirEntry);
+    return len;
+}
+
 // Is the directory dp empty except for "." and ".." ?
 static int isdirempty(Inode* dp) {
     usize off;
@@ -274,7 +442,6 @@ static int isdirempty(Inode* dp) {
 define_syscall(unlinkat, int fd, const char* path, int flag) {
     ASSERT(fd == AT_FDCWD && flag == 0);
     Inode *ip, *dp;
-    DirEntry de;
     char name[FILE_NAME_MAX_LENGTH];
     usize off;
     if (!user_strlen(path, 256))
@@ -307,9 +474,7 @@ define_syscall(unlinkat, int fd, const char* path, int flag) {
         goto bad;
     }
 
-    memset(&de, 0, sizeof(de));
-    if (inodes.write(&ctx, dp, (u8*)&de, off, sizeof(de)) != sizeof(de))
-        PANIC();
+    inodes.remove(&ctx, dp, off);
     if (ip->entry.type == INODE_DIRECTORY) {
         dp->entry.num_links--;
         inodes.sync(&ctx, dp, true);
@@ -504,11 +669,49 @@ define_syscall(chdir, const char* path) {
 define_syscall(pipe2, int *fd, int flags) {
     // TODO
     File* f0, *f1;
-    if(pipeAlloc(&f0, &f1) == -1){
+    if(pipeAlloc(&f0, &f1) < 0){
+        return -1;
+    }
+    if((fd[0] = fdalloc(f0)) < 0){
+        fileclose(f0);
+        fileclose(f1);
+        return -1;
+    }
+    if((fd[1] = fdalloc(f1)) < 0){
+        fileclose(free_fd(&thisproc()->oftable, fd[0]));
+        fileclose(f1);
         return -1;
     }
-    fd[0] = fdalloc(f0);
-    fd[1] = fdalloc(f1);
     flags = flags;
     return 0;
 }
+
+/*
+ * Move the oldest block I/O trace records to buf, see `block_trace_dump`.
+ * Returns the number of bytes, 0 once the trace is empty, -1 if the kernel
+ * is built without BLOCK_TRACE.
+ */
+define_syscall(blktrace, void* buf, usize size) {
+    if (!user_writeable(buf, size))
+        return -1;
+    // the trace lock is held while the records are copied, so they go
+    // through a kernel page rather than user memory that may fault.
+    u8* page = kalloc_page();
+    if (page == NULL)
+        return -1;
+    isize n = block_trace_dump(page, MIN(size, (usize)PAGE_SIZE));
+    if (n > 0)
+        memcpy(buf, page, (usize)n);
+    kfree_page(page);
+    return n;
+}
+
+/*
+ * Replay a dump of the block I/O trace on the device, see
+ * `block_trace_replay`. Returns the time it took in nanoseconds.
+ */
+define_syscall(blkreplay, const void* dump, usize size, int timed) {
+    if (!user_readable(dump, size))
+        return -1;
+    return block_trace_replay(dump, size, timed != 0);
+}
@@ -1,9 +1,18 @@
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <time.h>
+
 #include <kernel/syscall.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
+#include <kernel/cpu.h>
+#include <kernel/vdso.h>
+#include <common/string.h>
+#include <driver/clock.h>
 
 define_syscall(gettid) {
     return thisproc()->localpid;
@@ -81,3 +90,167 @@ define_syscall(wait4, int pid, int options, int* wstatus, void* rusage) {
     int code, id;
     return wait(&code, &id);
 }
+
+// there are no signals: every one but 0, which only checks `pid`, kills.
+define_syscall(kill, int pid, int sig) {
+    if (pid <= 0 || sig < 0)
+        return -EINVAL;
+    if (sig == 0)
+        return get_priority(pid) < 0 ? -ESRCH : 0;
+    if (kill_local(pid) < 0)
+        return -ESRCH;
+    return 0;
+}
+
+// there is no RTC, so every clock counts from boot, in ticks of
+// `get_timestamp`. CLOCK_REALTIME is ahead by what clock_settime sets, see
+// `struct vdso_data`, from which user space reads the same clocks.
+static bool valid_clock(int clockid) {
+    return clockid == CLOCK_REALTIME || clockid == CLOCK_MONOTONIC ||
+           clockid == CLOCK_MONOTONIC_RAW || clockid == CLOCK_BOOTTIME;
+}
+
+static i64 clock_offset(int clockid) {
+    return clockid == CLOCK_REALTIME ? get_realtime_offset() : 0;
+}
+
+define_syscall(clock_gettime, int clockid, struct timespec* tp) {
+    if (!valid_clock(clockid))
+        return -EINVAL;
+    if (!user_writeable(tp, sizeof(struct timespec)))
+        return -EFAULT;
+    u64 ns = get_timestamp_ns() + clock_offset(clockid);
+    tp->tv_sec = ns / 1000000000;
+    tp->tv_nsec = ns % 1000000000;
+    return 0;
+}
+
+// the latest time in ns, like Linux's KTIME_MAX. later ones are clamped to
+// it, so that a far deadline neither wraps around nor overflows a timer key.
+#define KTIME_MAX (~0ull >> 1)
+
+// of a valid, non-negative `t`.
+static u64 timespec_to_ns(const struct timespec* t) {
+    if ((u64)t->tv_sec >= KTIME_MAX / 1000000000)
+        return KTIME_MAX;
+    return t->tv_sec * 1000000000ull + t->tv_nsec;
+}
+
+define_syscall(clock_settime, int clockid, const struct timespec* tp) {
+    if (clockid != CLOCK_REALTIME)
+        return -EINVAL;
+    if (!user_readable(tp, sizeof(struct timespec)))
+        return -EFAULT;
+    if (tp->tv_sec < 0 || tp->tv_nsec < 0 || tp->tv_nsec >= 1000000000)
+        return -EINVAL;
+    set_realtime_offset(timespec_to_ns(tp) - get_timestamp_ns());
+    return 0;
+}
+
+// sleep for `req`, or until `req` with TIMER_ABSTIME. if woken up early,
+// return -EINTR and the time left in `rem`.
+static int do_nanosleep(int clockid, int flags, const struct timespec* req, struct timespec* rem) {
+    if (!user_readable(req, sizeof(struct timespec)))
+        return -EFAULT;
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+        return -EINVAL;
+    if (rem != NULL && !(flags & TIMER_ABSTIME) && !user_writeable(rem, sizeof(struct timespec)))
+        return -EFAULT;
+    u64 now = get_timestamp_ns();
+    u64 deadline = timespec_to_ns(req);
+    if (flags & TIMER_ABSTIME) {
+        i64 offset = clock_offset(clockid);
+        deadline = offset >= 0 ? deadline - MIN(deadline, (u64)offset) : deadline + (u64)-offset;
+    } else
+        deadline += now;
+    deadline = MIN(deadline, KTIME_MAX);
+    if (deadline <= now)
+        return 0;
+    if (sleep_until(get_timestamp() + ns_to_timestamp(deadline - now)))
+        return 0;
+    if (rem != NULL && !(flags & TIMER_ABSTIME)) {
+        u64 left = deadline - MIN(deadline, get_timestamp_ns());
+        rem->tv_sec = left / 1000000000;
+        rem->tv_nsec = left % 1000000000;
+    }
+    return -EINTR;
+}
+
+define_syscall(nanosleep, const struct timespec* req, struct timespec* rem) {
+    return do_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+}
+
+define_syscall(clock_nanosleep, int clockid, int flags, const struct timespec* req, struct timespec* rem) {
+    if (!valid_clock(clockid))
+        return -EINVAL;
+    return do_nanosleep(clockid, flags, req, rem);
+}
+
+// nice values map onto `prio_to_weight`, and are clamped like Linux does.
+static int nice_to_prio(int nice) {
+    return MIN(MAX(nice, -20), 19) + NICE_0_PRIO;
+}
+
+// like Linux, return 20 - nice so that the result is not negative, which
+// musl undoes.
+define_syscall(getpriority, int which, int who) {
+    if (which != PRIO_PROCESS)
+        return -EINVAL;
+    int prio = get_priority(who);
+    if (prio < 0)
+        return -ESRCH;
+    return 20 - (prio - NICE_0_PRIO);
+}
+
+define_syscall(setpriority, int which, int who, int nice) {
+    if (which != PRIO_PROCESS)
+        return -EINVAL;
+    if (set_priority(who, nice_to_prio(nice)) < 0)
+        return -ESRCH;
+    return 0;
+}
+
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+
+// see sched_setattr(2). musl has no struct for it.
+struct sched_attr {
+    u32 size;
+    u32 sched_policy;
+    u64 sched_flags;
+    i32 sched_nice;
+    u32 sched_priority;
+    u64 sched_runtime;
+    u64 sched_deadline;
+    u64 sched_period;
+};
+
+// only SCHED_OTHER and SCHED_BATCH, which are the same here: both run on
+// the weights of their nice values.
+define_syscall(sched_setattr, int pid, const struct sched_attr* attr, unsigned flags) {
+    if (!user_readable(attr, sizeof(u32)) || !user_readable(attr, MIN(attr->size, sizeof(struct sched_attr))))
+        return -EFAULT;
+    if (flags != 0 || attr->size < offset_of(struct sched_attr, sched_priority) || attr->sched_flags != 0)
+        return -EINVAL;
+    if (attr->sched_policy != SCHED_OTHER && attr->sched_policy != SCHED_BATCH)
+        return -EINVAL;
+    if (pid < 0 || set_priority(pid, nice_to_prio(attr->sched_nice)) < 0)
+        return -ESRCH;
+    return 0;
+}
+
+define_syscall(sched_getattr, int pid, struct sched_attr* attr, unsigned size, unsigned flags) {
+    if (flags != 0 || size < sizeof(struct sched_attr))
+        return -EINVAL;
+    if (!user_writeable(attr, sizeof(struct sched_attr)))
+        return -EFAULT;
+    int prio = pid < 0 ? -1 : get_priority(pid);
+    if (prio < 0)
+        return -ESRCH;
+    memset(attr, 0, sizeof(struct sched_attr));
+    attr->size = sizeof(struct sched_attr);
+    attr->sched_policy = SCHED_OTHER;
+    attr->sched_nice = prio - NICE_0_PRIO;
+    return 0;
+}
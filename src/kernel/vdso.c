@@ -0,0 +1,56 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/pt.h>
+#include <kernel/vdso.h>
+
+// both pages are in the kernel image, which `kfree_page` leaves alone. they
+// are mapped without `vmmap`, whose i8 reference count would overflow with
+// the number of address spaces sharing them.
+static u8 vdso_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+extern char vdso_start[], vdso_end[];
+static struct vdso_data* const vdso = (struct vdso_data*)vdso_page;
+static SpinLock vdso_lock;
+
+define_init(vdso)
+{
+    ASSERT(vdso_end - vdso_start == PAGE_SIZE);
+    ASSERT(offset_of(struct vdso_data, seq) == VDSO_SEQ);
+    ASSERT(offset_of(struct vdso_data, freq) == VDSO_FREQ);
+    ASSERT(offset_of(struct vdso_data, cntvct_offset) == VDSO_CNTVCT_OFFSET);
+    ASSERT(offset_of(struct vdso_data, realtime_ns) == VDSO_REALTIME_NS);
+    memset(vdso_page, 0, PAGE_SIZE);
+    init_spinlock(&vdso_lock);
+    u64 pct, vct;
+    asm volatile("isb; mrs %[p], cntpct_el0; mrs %[v], cntvct_el0" : [p] "=r"(pct), [v] "=r"(vct));
+    vdso->magic = VDSO_MAGIC;
+    vdso->freq = get_clock_frequency();
+    // both counters tick together, so the offset does not change.
+    vdso->cntvct_offset = pct - vct;
+    vdso->realtime_ns = 0;
+}
+
+void map_vdso(struct pgdir* pd)
+{
+    *get_pte(pd, VDSO_TEXT, true) = K2P(vdso_start) | PTE_USER_DATA | PTE_RO;
+    *get_pte(pd, VDSO_BASE, true) = K2P(vdso_page) | PTE_USER_DATA | PTE_RO;
+}
+
+i64 get_realtime_offset()
+{
+    return *(volatile i64*)&vdso->realtime_ns;
+}
+
+void set_realtime_offset(i64 ns)
+{
+    _acquire_spinlock(&vdso_lock);
+    vdso->seq++;
+    arch_fence();
+    vdso->realtime_ns = ns;
+    arch_fence();
+    vdso->seq++;
+    _release_spinlock(&vdso_lock);
+}
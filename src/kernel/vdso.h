@@ -0,0 +1,45 @@
+#pragma once
+
+// two read-only pages at the top of every user address space, from which
+// user space reads the clocks without a syscall:
+//
+// - VDSO_TEXT holds the vDSO image, src/user/vdso.S, a minimal ELF shared
+//   object that execve passes to user space as AT_SYSINFO_EHDR. musl looks
+//   it up for `__kernel_clock_gettime`.
+// - VDSO_BASE holds `struct vdso_data`, from which that function computes
+//
+//     CLOCK_MONOTONIC = (cntvct_el0 + cntvct_offset) / freq, in ns
+//     CLOCK_REALTIME  = CLOCK_MONOTONIC + realtime_ns
+//
+// the kernel only changes the fields under `seq` between two increments,
+// so a read is consistent if `seq` is the same even number before and
+// after it.
+#define VDSO_BASE  0xfffffffff000  // the last page of the user space.
+#define VDSO_TEXT  0xffffffffe000  // the page below it.
+#define VDSO_MAGIC 0x4f534456      // "VDSO"
+
+// offsets into `struct vdso_data` for vdso.S.
+#define VDSO_SEQ           4
+#define VDSO_FREQ          8
+#define VDSO_CNTVCT_OFFSET 16
+#define VDSO_REALTIME_NS   24
+
+#ifndef __ASSEMBLER__
+
+#include <common/defines.h>
+
+struct vdso_data {
+    u32 magic;
+    u32 seq;
+    u64 freq;           // of the counter, i.e. cntfrq_el0.
+    u64 cntvct_offset;  // cntpct_el0 - cntvct_el0.
+    i64 realtime_ns;    // set by clock_settime(CLOCK_REALTIME).
+};
+
+struct pgdir;
+
+void map_vdso(struct pgdir* pd);
+WARN_RESULT i64 get_realtime_offset();
+void set_realtime_offset(i64 ns);
+
+#endif
@@ -0,0 +1,62 @@
+#include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <fs/file.h>
+#include "test.h"
+
+#define FILE_BENCH_ROUNDS 100000
+
+static struct file* shared;
+
+// dup the shared file into the lowest fd and close it again, as
+// `dup(fd); close(nfd);` would do.
+static void dup_close(u64 rounds) {
+    auto oftable = &thisproc()->oftable;
+    for (u64 i = 0; i < rounds; i++) {
+        int fd = alloc_fd(oftable, filedup(shared));
+        ASSERT(fd >= 0);
+        fileclose(free_fd(oftable, fd));
+    }
+    exit(0);
+}
+
+// allocate a private file object and close it, as `pipe` or `open` would.
+static void alloc_close(u64 rounds) {
+    auto oftable = &thisproc()->oftable;
+    for (u64 i = 0; i < rounds; i++) {
+        int fd = alloc_fd(oftable, filealloc());
+        ASSERT(fd >= 0);
+        fileclose(free_fd(oftable, fd));
+    }
+    exit(0);
+}
+
+static void run(const char* name, void (*entry)(u64), int nproc) {
+    u64 begin = get_timestamp();
+    for (int i = 0; i < nproc; i++)
+        start_proc(create_proc(), entry, FILE_BENCH_ROUNDS);
+    int code, pid;
+    for (int i = 0; i < nproc; i++)
+        ASSERT(wait(&code, &pid) != -1);
+    u64 ticks = get_timestamp() - begin;
+    u64 ns = ticks * 1000000000 / get_clock_frequency();
+    printk("file_bench: %s x%d: %llu ns/op, %llu kops/s\n",
+           name, nproc,
+           ns / FILE_BENCH_ROUNDS,
+           (u64)nproc * FILE_BENCH_ROUNDS * 1000000 / MAX(ns, 1ull));
+}
+
+// with per-file atomic refcounts and per-process fd bitmaps, the ops/s of
+// both loops should scale with the number of processes up to NCPU.
+void file_bench() {
+    printk("file_bench\n");
+    shared = filealloc();
+    for (int nproc = 1; nproc <= NCPU; nproc *= 2) {
+        run("dup/close", dup_close, nproc);
+        run("alloc/close", alloc_close, nproc);
+    }
+    fileclose(shared);
+    printk("file_bench PASS\n");
+}
@@ -0,0 +1,142 @@
+#include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <common/sem.h>
+#include <driver/clock.h>
+#include <fs/file.h>
+#include <fs/pipe.h>
+#include "test.h"
+
+#define SCHED_BENCH_ROUNDS 100000
+#define PIPE_BENCH_ROUNDS 10000
+
+static Semaphore ping[NCPU], pong[NCPU];
+
+// each pair wakes the other up and goes to sleep, so every round is two
+// wakeups and two switches. the pairs should run on their own cpus.
+static void ping_entry(u64 i) {
+    for (int j = 0; j < SCHED_BENCH_ROUNDS; j++) {
+        post_sem(&ping[i]);
+        unalertable_wait_sem(&pong[i]);
+    }
+    exit(0);
+}
+
+static void pong_entry(u64 i) {
+    for (int j = 0; j < SCHED_BENCH_ROUNDS; j++) {
+        unalertable_wait_sem(&ping[i]);
+        post_sem(&pong[i]);
+    }
+    exit(0);
+}
+
+static void yield_entry(u64 arg) {
+    (void)arg;
+    for (int j = 0; j < SCHED_BENCH_ROUNDS; j++)
+        yield();
+    exit(0);
+}
+
+// the pipes go one way each: proc i of the pair writes pipe i and reads
+// pipe 1 - i. every message is the time it was sent, so that the receiver
+// measures how long its wakeup took.
+static File* pipe_r[2];
+static File* pipe_w[2];
+static u64 wakeup_ns_sum, wakeup_ns_max;
+
+static void pipe_send(u64 i) {
+    u64 sent = get_timestamp_ns();
+    ASSERT(filewrite(pipe_w[i], (char*)&sent, sizeof(sent)) == sizeof(sent));
+}
+
+static void pipe_receive(u64 i) {
+    u64 sent;
+    ASSERT(fileread(pipe_r[1 - i], (char*)&sent, sizeof(sent)) == sizeof(sent));
+    u64 ns = get_timestamp_ns() - sent;
+    wakeup_ns_sum += ns;
+    wakeup_ns_max = MAX(wakeup_ns_max, ns);
+}
+
+// proc 0 serves, proc 1 returns the ball.
+static void pipe_entry(u64 i) {
+    for (int j = 0; j < PIPE_BENCH_ROUNDS; j++) {
+        if (i == 0) {
+            pipe_send(i);
+            pipe_receive(i);
+        } else {
+            pipe_receive(i);
+            pipe_send(i);
+        }
+    }
+    exit(0);
+}
+
+static u64 begin;
+
+static void report(const char* name, int nproc, u64 ops) {
+    u64 ticks = get_timestamp() - begin;
+    u64 ns = ticks * 1000000000 / get_clock_frequency();
+    printk("sched_bench: %s x%d: %llu ns/op, %llu kops/s\n",
+           name, nproc,
+           ns / MAX(ops, 1ull),
+           ops * 1000000 / MAX(ns, 1ull));
+}
+
+static void wait_all(int nproc) {
+    int code, pid;
+    for (int i = 0; i < nproc; i++)
+        ASSERT(wait(&code, &pid) != -1);
+}
+
+// with per-cpu run queues, the wakeups/s of the pairs and the switches/s
+// of the yield loops should scale with the number of procs up to NCPU.
+void sched_bench() {
+    printk("sched_bench\n");
+    u64 timer_irqs[NCPU], idle_timer_irqs[NCPU];
+    for (int i = 0; i < NCPU; i++) {
+        timer_irqs[i] = cpus[i].timer_irqs;
+        idle_timer_irqs[i] = cpus[i].idle_timer_irqs;
+    }
+    for (int npair = 1; npair <= NCPU; npair *= 2) {
+        begin = get_timestamp();
+        for (int i = 0; i < npair; i++) {
+            init_sem(&ping[i], 0);
+            init_sem(&pong[i], 0);
+            start_proc(create_proc(), ping_entry, i);
+            start_proc(create_proc(), pong_entry, i);
+        }
+        wait_all(2 * npair);
+        report("ping-pong", npair, 2ull * npair * SCHED_BENCH_ROUNDS);
+    }
+    // a reader wakes up on an idle cpu through an IPI, rather than at its
+    // next timer tick.
+    ASSERT(pipeAlloc(&pipe_r[0], &pipe_w[0]) == 0);
+    ASSERT(pipeAlloc(&pipe_r[1], &pipe_w[1]) == 0);
+    begin = get_timestamp();
+    for (int i = 0; i < 2; i++)
+        start_proc(create_proc(), pipe_entry, i);
+    wait_all(2);
+    report("pipe ping-pong", 1, 2ull * PIPE_BENCH_ROUNDS);
+    printk("sched_bench: pipe wakeup latency: %llu ns avg, %llu ns max\n",
+           wakeup_ns_sum / (2 * PIPE_BENCH_ROUNDS), wakeup_ns_max);
+    for (int i = 0; i < 2; i++) {
+        fileclose(pipe_r[i]);
+        fileclose(pipe_w[i]);
+    }
+    for (int nproc = 2; nproc <= 2 * NCPU; nproc *= 2) {
+        begin = get_timestamp();
+        for (int i = 0; i < nproc; i++)
+            start_proc(create_proc(), yield_entry, 0);
+        wait_all(nproc);
+        report("yield", nproc, (u64)nproc * SCHED_BENCH_ROUNDS);
+    }
+    // without a tick for idle cpus and lone procs, only the crowded runs
+    // should take timer interrupts.
+    for (int i = 0; i < NCPU; i++) {
+        printk("sched_bench: cpu %d: %llu timer interrupts, %llu while idle\n",
+               i, cpus[i].timer_irqs - timer_irqs[i], cpus[i].idle_timer_irqs - idle_timer_irqs[i]);
+    }
+    printk("sched_bench PASS\n");
+}
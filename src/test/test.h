@@ -9,6 +9,9 @@ void ipc_test();
 void vm_test();
 void container_test();
 void user_proc_test();
+void file_bench();
+void sched_bench();
+void timer_bench();
 unsigned rand();
 void srand(unsigned seed);
 void pgfault_first_test();
@@ -0,0 +1,81 @@
+#include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <driver/clock.h>
+#include "test.h"
+
+#define TIMER_BENCH_MAX 4096
+#define TIMER_BENCH_SLEEPERS 512
+#define TIMER_BENCH_SLEEPS 20
+#define TIMER_BENCH_SLEEP_NS 1000000
+
+static struct timer timers[TIMER_BENCH_MAX];
+
+static void never(struct timer* t) {
+    (void)t;
+    PANIC();
+}
+
+static u64 ticks_to_ns(u64 ticks) {
+    return ticks * 1000000000 / get_clock_frequency();
+}
+
+// arm `n` timers far in the future, then cancel them, in a shuffled
+// order so that neither end of the tree is favored.
+static void set_cancel(int n) {
+    for (int i = 0; i < n; i++) {
+        timers[i].elapse = 1000000 + rand() % 1000000;
+        timers[i].elapse_ns = 0;
+        timers[i].handler = never;
+    }
+    u64 begin = get_timestamp();
+    for (int i = 0; i < n; i++)
+        set_cpu_timer(&timers[i]);
+    u64 set = get_timestamp() - begin;
+    begin = get_timestamp();
+    for (int i = 0; i < n; i++)
+        cancel_cpu_timer(&timers[(i * 7919) % n]);
+    u64 cancel = get_timestamp() - begin;
+    printk("timer_bench: %d timers: set %llu ns/op, cancel %llu ns/op\n",
+           n, ticks_to_ns(set) / n, ticks_to_ns(cancel) / n);
+}
+
+static u64 late_ns_sum, late_ns_max;
+static SpinLock late_lock;
+
+static void sleeper(u64 arg) {
+    (void)arg;
+    for (int i = 0; i < TIMER_BENCH_SLEEPS; i++) {
+        u64 deadline = get_timestamp() + ns_to_timestamp(TIMER_BENCH_SLEEP_NS);
+        ASSERT(sleep_until(deadline));
+        u64 late = ticks_to_ns(get_timestamp() - deadline);
+        _acquire_spinlock(&late_lock);
+        late_ns_sum += late;
+        late_ns_max = MAX(late_ns_max, late);
+        _release_spinlock(&late_lock);
+    }
+    exit(0);
+}
+
+// the cost of a timer should not grow much with the number of pending
+// ones, and sleepers should wake up close to their deadlines.
+void timer_bench() {
+    printk("timer_bench\n");
+    for (int n = 64; n <= TIMER_BENCH_MAX; n *= 4)
+        set_cancel(n);
+
+    init_spinlock(&late_lock);
+    u64 begin = get_timestamp();
+    for (int i = 0; i < TIMER_BENCH_SLEEPERS; i++)
+        start_proc(create_proc(), sleeper, 0);
+    int code, pid;
+    for (int i = 0; i < TIMER_BENCH_SLEEPERS; i++)
+        ASSERT(wait(&code, &pid) != -1);
+    u64 n = (u64)TIMER_BENCH_SLEEPERS * TIMER_BENCH_SLEEPS;
+    printk("timer_bench: %d sleepers x%d: %llu ns total, late %llu ns avg, %llu ns max\n",
+           TIMER_BENCH_SLEEPERS, TIMER_BENCH_SLEEPS,
+           ticks_to_ns(get_timestamp() - begin), late_ns_sum / n, late_ns_max);
+    printk("timer_bench PASS\n");
+}
@@ -0,0 +1,100 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../fs/block_device.h"
+#include "../../kernel/syscallno.h"
+
+static void usage() {
+    fprintf(stderr, "Usage: blktrace [file]\n"
+                    "       blktrace -r [-t] file\n");
+    exit(1);
+}
+
+// replay a dump on the device, see `block_trace_replay`. with `timed`,
+// records keep their offsets in the trace.
+static void replay(const char *path, int timed) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "blktrace: cannot open %s\n", path);
+        exit(1);
+    }
+    usize size = 0, capacity = 0;
+    char *dump = NULL;
+    long n;
+    do {
+        if (size == capacity) {
+            capacity = capacity ? 2 * capacity : 4096;
+            if ((dump = realloc(dump, capacity)) == NULL) {
+                fprintf(stderr, "blktrace: out of memory\n");
+                exit(1);
+            }
+        }
+        if ((n = read(fd, dump + size, capacity - size)) < 0) {
+            fprintf(stderr, "blktrace: read failed\n");
+            exit(1);
+        }
+        size += n;
+    } while (n > 0);
+    close(fd);
+
+    long ns = syscall(SYS_blkreplay, dump, size, timed);
+    if (ns < 0) {
+        fprintf(stderr, "blktrace: failed to replay %s\n", path);
+        exit(1);
+    }
+    printf("replayed %s in %ld.%03ld ms\n", path, ns / 1000000, ns / 1000 % 1000);
+    exit(0);
+}
+
+// dump the block I/O trace of the kernel to a file, or to stdout.
+// the whole trace is taken before anything is written, so that the
+// writes do not show up in the dump.
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        if (argc == 3)
+            replay(argv[2], 0);
+        if (argc == 4 && strcmp(argv[2], "-t") == 0)
+            replay(argv[3], 1);
+        usage();
+    }
+    if (argc > 2)
+        usage();
+
+    static char page[4096];
+    usize size = 0, capacity = 0;
+    char *dump = NULL;
+    long n;
+    while ((n = syscall(SYS_blktrace, page, sizeof(page))) > 0) {
+        if (size + n > capacity) {
+            capacity = 2 * (size + n);
+            if ((dump = realloc(dump, capacity)) == NULL) {
+                fprintf(stderr, "blktrace: out of memory\n");
+                exit(1);
+            }
+        }
+        memcpy(dump + size, page, n);
+        size += n;
+    }
+    if (n < 0) {
+        fprintf(stderr, "blktrace: failed to read the trace, is the kernel built with BLOCK_TRACE?\n");
+        exit(1);
+    }
+
+    int fd = 1;
+    if (argc == 2 && (fd = open(argv[1], O_CREAT | O_WRONLY | O_TRUNC, 0666)) < 0) {
+        fprintf(stderr, "blktrace: cannot open %s\n", argv[1]);
+        exit(1);
+    }
+    for (usize i = 0; i < size;) {
+        if ((n = write(fd, dump + i, size - i)) <= 0) {
+            fprintf(stderr, "blktrace: write failed\n");
+            exit(1);
+        }
+        i += n;
+    }
+    close(fd);
+    exit(0);
+}
@@ -3,11 +3,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "../../fs/defines.h"
 #define DIRSIZ FILE_NAME_MAX_LENGTH
 
+struct linux_dirent64 {
+    unsigned long d_ino;
+    long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
 char *fmtname(char *path) {
     static char buf[DIRSIZ + 1];
     char *p;
@@ -25,9 +34,8 @@ char *fmtname(char *path) {
 }
 
 void ls(char *path) {
-    char buf[512], *p;
-    int fd;
-    DirEntry de;
+    char buf[4096];
+    int fd, n;
     struct stat st;
 
     if ((fd = open(path, O_RDONLY)) < 0) {
@@ -44,22 +52,17 @@ void ls(char *path) {
     if (S_ISREG(st.st_mode)) {
         printf("%s %x %ld %ld\n", fmtname(path), st.st_mode, st.st_ino, st.st_size);
     } else if (S_ISDIR(st.st_mode)) {
-        if (strlen(path) + 1 + DIRSIZ + 1 > sizeof(buf)) {
-            fprintf(stderr, "ls: path too long\n");
-        } else {
-            strcpy(buf, path);
-            p = buf + strlen(buf);
-            *p++ = '/';
-            while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-                if (de.inode_no == 0)
-                    continue;
-                memmove(p, de.name, DIRSIZ);
-                p[DIRSIZ] = 0;
-                if (stat(buf, &st) < 0) {
-                    fprintf(stderr, "ls: cannot stat %s\n", buf);
+        // each call returns a buffer of entries, which are then stat'ed
+        // relative to the open directory instead of by full path.
+        while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+            for (int off = 0; off < n;) {
+                struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+                off += d->d_reclen;
+                if (fstatat(fd, d->d_name, &st, 0) < 0) {
+                    fprintf(stderr, "ls: cannot stat %s/%s\n", path, d->d_name);
                     continue;
                 }
-                printf("%s %x %ld %ld\n", fmtname(buf), st.st_mode, st.st_ino, st.st_size);
+                printf("%s %x %ld %ld\n", fmtname(d->d_name), st.st_mode, st.st_ino, st.st_size);
             }
         }
     }
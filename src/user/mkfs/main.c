@@ -51,6 +51,8 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+uint nextblock(void);
+
 void balloc(int);
 void wsect(uint, void *);
 void winode(uint, struct dinode *);
@@ -87,8 +89,16 @@ int main(int argc, char *argv[]) {
 
     static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+    // "-o" puts the kernel in ordered-data mode on this image, see `SB_ORDERED_DATA`.
+    uint flags = 0;
+    if (argc > 1 && strcmp(argv[1], "-o") == 0) {
+        flags |= SB_ORDERED_DATA;
+        argc--;
+        argv++;
+    }
+
     if (argc < 2) {
-        fprintf(stderr, "Usage: mkfs fs.img files...\n");
+        fprintf(stderr, "Usage: mkfs [-o] fs.img files...\n");
         exit(1);
     }
 
@@ -101,10 +111,13 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    // 1 fs block = 1 disk sector
+    // 1 fs block = SECTORS_PER_BLOCK disk sectors
     nmeta = 2 + num_log_blocks + ninodeblocks + nbitmap;
     num_data_blocks = FSSIZE - nmeta;
 
+    sb.magic = xint(FS_MAGIC);
+    sb.version = xint(FS_VERSION);
+    sb.block_size = xint(BSIZE);
     sb.num_blocks = xint(FSSIZE);
     sb.num_data_blocks = xint(num_data_blocks);
     sb.num_inodes = xint(NINODES);
@@ -112,6 +125,7 @@ int main(int argc, char *argv[]) {
     sb.log_start = xint(2);
     sb.inode_start = xint(2 + num_log_blocks);
     sb.bitmap_start = xint(2 + num_log_blocks + ninodeblocks);
+    sb.flags = xint(flags);
 
     printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d "
            "total %d\n",
@@ -251,18 +265,31 @@ uint ialloc(ushort type) {
     return inum;
 }
 
+// return the next free block, skipping over the swap area.
+uint nextblock(void) {
+    if (freeblock >= SWAP_START && freeblock < SWAP_END)
+        freeblock = SWAP_END;
+    assert(freeblock < FSSIZE);
+    return freeblock++;
+}
+
+// mark the first `used` blocks and the swap area as allocated.
 void balloc(int used) {
     uchar buf[BSIZE];
-    int i;
+    int i, b;
 
     printf("balloc: first %d blocks have been allocated\n", used);
-    assert(used < BSIZE * 8);
-    bzero(buf, BSIZE);
-    for (i = 0; i < used; i++) {
-        buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+    assert(used <= FSSIZE);
+    for (b = 0; b < nbitmap; b++) {
+        bzero(buf, BSIZE);
+        for (i = 0; i < BSIZE * 8; i++) {
+            int bno = b * BSIZE * 8 + i;
+            if (bno < used || (bno >= SWAP_START && bno < SWAP_END))
+                buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+        printf("balloc: write bitmap block at sector %d\n", sb.bitmap_start + b);
+        wsect(sb.bitmap_start + b, buf);
     }
-    printf("balloc: write bitmap block at sector %d\n", sb.bitmap_start);
-    wsect(sb.bitmap_start, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -273,7 +300,7 @@ void iappend(uint inum, void *xp, int n) {
     struct dinode din;
     char buf[BSIZE];
     uint indirect[NINDIRECT];
-    uint x;
+    uint x, y;
 
     rinode(inum, &din);
     off = xint(din.num_bytes);
@@ -283,19 +310,36 @@ void iappend(uint inum, void *xp, int n) {
         assert(fbn < INODE_MAX_BLOCKS);
         if (fbn < NDIRECT) {
             if (xint(din.addrs[fbn]) == 0) {
-                din.addrs[fbn] = xint(freeblock++);
+                din.addrs[fbn] = xint(nextblock());
             }
             x = xint(din.addrs[fbn]);
-        } else {
+        } else if (fbn < NDIRECT + NINDIRECT) {
             if (xint(din.indirect) == 0) {
-                din.indirect = xint(freeblock++);
+                din.indirect = xint(nextblock());
             }
             rsect(xint(din.indirect), (char *)indirect);
             if (indirect[fbn - NDIRECT] == 0) {
-                indirect[fbn - NDIRECT] = xint(freeblock++);
+                indirect[fbn - NDIRECT] = xint(nextblock());
                 wsect(xint(din.indirect), (char *)indirect);
             }
             x = xint(indirect[fbn - NDIRECT]);
+        } else {
+            uint k = fbn - NDIRECT - NINDIRECT;
+            if (xint(din.double_indirect) == 0) {
+                din.double_indirect = xint(nextblock());
+            }
+            rsect(xint(din.double_indirect), (char *)indirect);
+            if (indirect[k / NINDIRECT] == 0) {
+                indirect[k / NINDIRECT] = xint(nextblock());
+                wsect(xint(din.double_indirect), (char *)indirect);
+            }
+            y = xint(indirect[k / NINDIRECT]);
+            rsect(y, (char *)indirect);
+            if (indirect[k % NINDIRECT] == 0) {
+                indirect[k % NINDIRECT] = xint(nextblock());
+                wsect(y, (char *)indirect);
+            }
+            x = xint(indirect[k % NINDIRECT]);
         }
         n1 = min(n, (fbn + 1) * BSIZE - off);
         rsect(x, buf);
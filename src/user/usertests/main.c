@@ -1,11 +1,23 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/auxv.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <fs/defines.h>
+#include <kernel/vdso.h>
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
 
 char buf[8192];
 char name[3];
@@ -75,6 +87,9 @@ void writetest(void) {
     printf("small file test ok\n");
 }
 
+// enough blocks to reach into the double indirect block.
+#define BIG_NUM_BLOCKS (INODE_NUM_DIRECT + INODE_NUM_INDIRECT + 8)
+
 void writetestbig(void) {
     int i, fd, n;
 
@@ -86,9 +101,9 @@ void writetestbig(void) {
         exit(1);
     }
 
-    for (i = 0; i < INODE_MAX_BLOCKS; i++) {
+    for (i = 0; i < BIG_NUM_BLOCKS; i++) {
         ((int*)buf)[0] = i;
-        if (write(fd, buf, 512) != 512) {
+        if (write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
             printf("error: write big file failed\n");
             exit(1);
         }
@@ -104,14 +119,14 @@ void writetestbig(void) {
 
     n = 0;
     for (;;) {
-        i = read(fd, buf, 512);
+        i = read(fd, buf, BLOCK_SIZE);
         if (i == 0) {
-            if (n == INODE_MAX_BLOCKS - 1) {
+            if (n != BIG_NUM_BLOCKS) {
                 printf("read only %d blocks from big", n);
                 exit(1);
             }
             break;
-        } else if (i != 512) {
+        } else if (i != BLOCK_SIZE) {
             printf("read failed %d\n", i);
             exit(1);
         }
@@ -150,6 +165,258 @@ void createtest(void) {
     printf("many creates, followed by unlink; ok\n");
 }
 
+static uint64_t ticks(void) {
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+}
+
+static uint64_t ticks_per_second(void) {
+    uint64_t f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+
+// clock_gettime without the vDSO.
+static int sys_clock_gettime(clockid_t clk, struct timespec* ts) {
+    return syscall(SYS_clock_gettime, clk, ts);
+}
+
+static uint64_t timespec_ns(const struct timespec* ts) {
+    return ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// time `n` reads of CLOCK_MONOTONIC with `gettime`, checking that they
+// never go backwards.
+static void timebench(const char* name, int (*gettime)(clockid_t, struct timespec*), int n) {
+    struct timespec ts;
+    uint64_t last = 0;
+    uint64_t start = ticks();
+    for (int i = 0; i < n; i++) {
+        gettime(CLOCK_MONOTONIC, &ts);
+        if (timespec_ns(&ts) < last) {
+            printf("%s went backwards\n", name);
+            exit(1);
+        }
+        last = timespec_ns(&ts);
+    }
+    uint64_t t = ticks() - start;
+    printf("%s: %lu ns/call\n", name, t * 1000000000 / ticks_per_second() / n);
+}
+
+void timetest(void) {
+    struct timespec before, vts, after;
+
+    printf("time test\n");
+    if (getauxval(AT_SYSINFO_EHDR) != VDSO_TEXT) {
+        printf("no vdso\n");
+        exit(1);
+    }
+    sys_clock_gettime(CLOCK_MONOTONIC, &before);
+    clock_gettime(CLOCK_MONOTONIC, &vts);
+    sys_clock_gettime(CLOCK_MONOTONIC, &after);
+    if (timespec_ns(&vts) < timespec_ns(&before) || timespec_ns(&vts) > timespec_ns(&after)) {
+        printf("vdso and syscall clocks disagree\n");
+        exit(1);
+    }
+    timebench("clock_gettime syscall", sys_clock_gettime, 100000);
+    timebench("clock_gettime vdso", clock_gettime, 100000);
+    printf("time test ok\n");
+}
+
+#define NICE_SPINNERS 8
+#define NICE_SPIN_NS 2000000000ull
+#define NICE_MIN_RATIO 110  // in percent.
+
+// see sched_setattr(2).
+struct sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+// spin until `deadline` and report how many rounds spinner `i` got.
+static void spin(int fd, int i, uint64_t deadline) {
+    struct timespec ts;
+    uint64_t report[2] = {i, 0};
+    do {
+        for (volatile int j = 0; j < 1000; j++)
+            ;
+        report[1]++;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    } while (timespec_ns(&ts) < deadline);
+    if (write(fd, report, sizeof(report)) != sizeof(report))
+        exit(1);
+    exit(0);
+}
+
+// half of the spinners run at nice 0, set by sched_setattr, and half at
+// nice 5, set by nice. with more spinners than cpus, the first half should
+// get about 1024 / 335 times the cpu of the second.
+void nicetest(void) {
+    int p[2];
+    struct timespec ts;
+
+    printf("nice test\n");
+    if (setpriority(PRIO_PROCESS, 0, 3) != 0 || getpriority(PRIO_PROCESS, 0) != 3 ||
+        nice(1) != 4 || getpriority(PRIO_PROCESS, 0) != 4) {
+        printf("setpriority/getpriority/nice failed\n");
+        exit(1);
+    }
+    if (pipe(p) != 0) {
+        printf("pipe() failed\n");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t deadline = timespec_ns(&ts) + NICE_SPIN_NS;
+    for (int i = 0; i < NICE_SPINNERS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(p[0]);
+            if (i % 2 == 0) {
+                struct sched_attr attr = {.size = sizeof(attr), .sched_nice = 0};
+                if (syscall(SYS_sched_setattr, 0, &attr, 0) != 0)
+                    exit(1);
+            } else if (nice(1) != 5) {
+                exit(1);
+            }
+            spin(p[1], i, deadline);
+        }
+    }
+    close(p[1]);
+    uint64_t rounds[2] = {0, 0}, report[2];
+    int n = 0;
+    while (read(p[0], report, sizeof(report)) == sizeof(report)) {
+        rounds[report[0] % 2] += report[1];
+        n++;
+    }
+    close(p[0]);
+    for (int i = 0; i < NICE_SPINNERS; i++)
+        wait(NULL);
+    if (n != NICE_SPINNERS) {
+        printf("%d of %d spinners reported\n", n, NICE_SPINNERS);
+        exit(1);
+    }
+    uint64_t ratio = rounds[0] * 100 / (rounds[1] ? rounds[1] : 1);
+    printf("nice 0 / nice 5 cpu share: %lu.%02lu (ideal 3.06)\n", ratio / 100, ratio % 100);
+    // there is no affinity to keep a nice 0 and a nice 5 spinner on each
+    // cpu, and the balancer moves them around, so how close the share gets
+    // to the ideal depends on where they run. only check that nice 0 gets
+    // clearly more.
+    if (ratio < NICE_MIN_RATIO) {
+        printf("nice does not change the cpu share\n");
+        exit(1);
+    }
+    setpriority(PRIO_PROCESS, 0, 0);
+    printf("nice test ok\n");
+}
+
+// a spinner alone on its cpu runs without a tick, so nothing brings it
+// back to the kernel to see that it was killed unless kill does.
+void killtest(void) {
+    int p[2];
+    char c = 0;
+
+    printf("kill test\n");
+    if (pipe(p) != 0) {
+        printf("pipe() failed\n");
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(p[0]);
+        if (write(p[1], &c, 1) != 1)
+            exit(1);
+        for (;;)
+            ;
+    }
+    close(p[1]);
+    if (read(p[0], &c, 1) != 1) {
+        printf("spinner did not start\n");
+        exit(1);
+    }
+    close(p[0]);
+    // sleep, so that the spinner is left alone on its cpu.
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100000000};
+    nanosleep(&ts, NULL);
+    if (kill(pid, SIGKILL) != 0) {
+        printf("kill failed\n");
+        exit(1);
+    }
+    wait(NULL);
+    printf("kill test ok\n");
+}
+
+static char pipebuf[65536];
+
+// push `total` bytes through a pipe in `chunk` sized reads and writes.
+void pipebench(int chunk, int total) {
+    int p[2], n, got = 0;
+
+    if (pipe(p) != 0) {
+        printf("pipe() failed\n");
+        exit(1);
+    }
+    if (fcntl(p[1], F_SETPIPE_SZ, 65536) != 65536) {
+        printf("F_SETPIPE_SZ failed\n");
+        exit(1);
+    }
+    if (fcntl(p[1], F_SETPIPE_SZ, 1ul << 40) != -1 || errno != EINVAL) {
+        printf("F_SETPIPE_SZ took a huge size\n");
+        exit(1);
+    }
+    uint64_t start = ticks();
+    int pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(p[0]);
+        for (int i = 0; i < total; i += chunk) {
+            if (write(p[1], pipebuf, chunk) != chunk) {
+                printf("pipe write failed\n");
+                exit(1);
+            }
+        }
+        exit(0);
+    }
+    close(p[1]);
+    while ((n = read(p[0], pipebuf, chunk)) > 0)
+        got += n;
+    close(p[0]);
+    wait(NULL);
+    uint64_t t = ticks() - start;
+    if (got != total) {
+        printf("pipe read %d of %d bytes\n", got, total);
+        exit(1);
+    }
+    uint64_t bps = (uint64_t)total * ticks_per_second() / (t ? t : 1);
+    printf("pipe %d byte transfers: %lu.%02lu MB/s\n",
+           chunk, bps >> 20, (bps & ((1 << 20) - 1)) * 100 >> 20);
+}
+
+void pipetest(void) {
+    printf("pipe throughput test\n");
+    pipebench(1, 64 * 1024);
+    pipebench(512, 4 * 1024 * 1024);
+    pipebench(65536, 16 * 1024 * 1024);
+    printf("pipe throughput test ok\n");
+}
+
 int main(int argc, char* argv[]) {
     printf("usertests starting\n");
 
@@ -157,6 +424,10 @@ int main(int argc, char* argv[]) {
     writetest();
     writetestbig();
     createtest();
+    pipetest();
+    timetest();
+    nicetest();
+    killtest();
 
     exit(0);
 }